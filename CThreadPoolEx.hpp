@@ -30,9 +30,28 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <atlutil.h>
 
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <exception>
+
+// Awaitable asynchronous I/O is only available, if the compiler supports C++20 coroutines.
+#define ATLS_POOLEX_COROUTINES
+#endif
+
 using namespace ATL;
 
 /// <summary>
@@ -175,6 +194,64 @@ public:
 	}
 };
 
+/// <summary>
+/// Provides an execution method for the worker archetype, that invokes the expression stored within a <see cref="LambdaRequest">`LambdaRequest`</see>, but defers
+/// its destruction.
+/// </summary>
+/// <remarks>
+/// Destroying a request also destroys the state it has captured, which may be expensive, i.e. for large containers or the last reference to a shared object.
+/// Completed requests are collected instead and destroyed in a batch, as soon as `nBatchSize` requests have completed or `CThreadPoolEx` is about to wait for
+/// new requests, whichever comes first. This keeps destructors off the path between two requests, as long as the worker is busy.
+/// </remarks>
+///
+/// <seealso cref="https://docs.microsoft.com/en-us/cpp/atl/reference/worker-archetype">Worker Archetype</seealso>
+template <class TRequest, UINT nBatchSize = 64>
+class CThreadDeferredLambdaExecutorTraits :
+	public CThreadExecutorTraits<TRequest>
+{
+	static_assert(nBatchSize > 0, "The batch size must not be zero.");
+
+private:
+	TRequest* m_completed[nBatchSize];
+	UINT m_nCompleted;
+
+public:
+	CThreadDeferredLambdaExecutorTraits() throw() :
+		m_nCompleted(0)
+	{
+	}
+
+	virtual ~CThreadDeferredLambdaExecutorTraits() throw()
+	{
+		this->Idle(nullptr);
+	}
+
+public:
+	/// <summary>
+	/// Called by the worker thread to invoke the expression stored within the request parameters.
+	/// </summary>
+	virtual void Execute(RequestType request, LPVOID config, OVERLAPPED* overlapped) throw() override
+	{
+		request->Invoke();
+
+		if (m_nCompleted == nBatchSize)
+			this->Idle(config);
+
+		m_completed[m_nCompleted++] = request;
+	}
+
+	/// <summary>
+	/// Called by `CThreadPoolEx` before the worker thread waits for new requests, in order to destroy all completed requests.
+	/// </summary>
+	void Idle(LPVOID config) throw()
+	{
+		for (UINT nRequest = 0; nRequest < m_nCompleted; nRequest++)
+			delete m_completed[nRequest];
+
+		m_nCompleted = 0;
+	}
+};
+
 /// <summary>
 /// Describes a default worker archetype implementation, using on a user-defined request type.
 /// </summary>
@@ -212,6 +289,22 @@ typedef CLambdaWorkerBase<CThreadInitializeTraits> LambdaWorker;
 /// <seealso cref="https://docs.microsoft.com/en-us/cpp/atl/reference/worker-archetype">Worker Archetype</seealso>
 typedef CLambdaWorkerBase<CComThreadInitializeTraits> ComLambdaWorker;
 
+/// <summary>
+/// Describes a worker archetype implementation, using on an expression-based request type, whose requests are destroyed in batches.
+/// </summary>
+///
+/// <seealso cref="CThreadDeferredLambdaExecutorTraits">`CThreadDeferredLambdaExecutorTraits`</seealso>
+template <class TThreadInitializeTraits = CThreadInitializeTraits, UINT nBatchSize = 64>
+class CDeferredLambdaWorkerBase :
+	public CWorkerArchetype<LambdaRequest, TThreadInitializeTraits, CThreadDeferredLambdaExecutorTraits<LambdaRequest, nBatchSize>>
+{
+};
+
+/// <summary>
+/// Describes a default worker archetype implementation, using on an expression-based request type, whose requests are destroyed in batches.
+/// </summary>
+typedef CDeferredLambdaWorkerBase<CThreadInitializeTraits> DeferredLambdaWorker;
+
 /// <summary>
 /// Implement this base class within a custom CThreadPool implementation to support custom delegation to custom `ThreadProc` implementations for worker threads.
 /// </summary>
@@ -275,86 +368,6571 @@ public:
 };
 
 /// <summary>
-/// An extented worker thread.
+/// Describes a thread that reads shared data, which is protected by a <see cref="CEpochDomain">`CEpochDomain`</see>.
 /// </summary>
 /// <remarks>
-/// The default `CThreadPool` implementation does not correctly remove a thread, if it's handle is closed on application shutdown, i.e. `GetQueuedCompletionStatus` returns `FALSE`.
-/// The extented thread pool fixes this issue. *
+/// A participant is either online, in which case it stores the global epoch it has last observed, or offline (epoch `0`), in which case it does not hold any references to shared data.
 /// </remarks>
-template <class TWorker, class TThreadTraits = ThreadProcHookThreadTraits<DefaultThreadTraits>, class TWaitTraits = DefaultWaitTraits>
-class CThreadPoolEx : 
-	public CThreadPool<TWorker, TThreadTraits, TWaitTraits>,
-	public CThreadProcHook
+class CEpochParticipant
 {
+	friend class CEpochDomain;
+
+private:
+	volatile LONG64 m_llEpoch;
+	CEpochParticipant* m_pNext;
+
 public:
-	CThreadPoolEx() throw() :
-		CThreadPool()
+	CEpochParticipant() throw() :
+		m_llEpoch(0), m_pNext(nullptr)
 	{
 	}
 
-	virtual ~CThreadPoolEx() throw()
+private:
+	CEpochParticipant(const CEpochParticipant& participant) = delete;
+};
+
+/// <summary>
+/// Implements quiescent-state based memory reclamation (RCU) for objects that are read by worker threads without locks.
+/// </summary>
+/// <remarks>
+/// Writers unlink an object from a shared structure and pass it to `Retire`, which tags it with a new global epoch. The object is destroyed by `Collect`, as soon as
+/// every online participant has observed this or a later epoch, i.e. has passed a quiescent state after the object has been unlinked. Readers do not pay anything
+/// on access. They only announce quiescent states, which `CThreadPoolEx` does for its workers between two requests.
+/// </remarks>
+class CEpochDomain
+{
+private:
+	struct CRetiredObject
 	{
-	}
+		CRetiredObject* m_pNext;
+		LONG64 m_llEpoch;
 
-protected:
-	virtual DWORD CThreadProcHook::ThreadProc() throw() override
+		virtual ~CRetiredObject()
+		{
+		}
+	};
+
+	template <class T, class TDeleter>
+	struct CRetiredObjectT :
+		public CRetiredObject
 	{
-		DWORD dwBytesTransfered;
-		ULONG_PTR dwCompletionKey;
+		T* m_pObject;
+		TDeleter m_deleter;
 
-		OVERLAPPED* pOverlapped;
+		template <class TDeleterArg>
+		CRetiredObjectT(T* object, TDeleterArg&& deleter) :
+			m_pObject(object), m_deleter(std::forward<TDeleterArg>(deleter))
+		{
+		}
 
-		// this block is to ensure theWorker gets destructed before the
-		// thread handle is closed
+		virtual ~CRetiredObjectT() override
 		{
-			// We instantiate an instance of the worker class on the stack
-			// for the life time of the thread.
-			TWorker theWorker;
+			m_deleter(m_pObject);
+		}
+	};
 
-			if (theWorker.Initialize(m_pvWorkerParam) == FALSE)
+private:
+	CComAutoCriticalSection m_critSec;
+	volatile LONG64 m_llGlobalEpoch;
+	volatile LONG m_lRetired;
+	LONG m_lCollectThreshold;
+	CEpochParticipant* m_pParticipants;
+	CRetiredObject* m_pRetired;
+
+public:
+	/// <summary>
+	/// Creates a domain, that collects after every `lCollectThreshold` retired objects. Thresholds below 1 are clamped to 1, which collects on every retire.
+	/// </summary>
+	CEpochDomain(LONG lCollectThreshold = 64) throw() :
+		m_llGlobalEpoch(1), m_lRetired(0), m_lCollectThreshold((std::max)(lCollectThreshold, static_cast<LONG>(1))), m_pParticipants(nullptr), m_pRetired(nullptr)
+	{
+	}
+
+	/// <summary>
+	/// Destroys all objects that are still retired. There must not be any online participants left.
+	/// </summary>
+	virtual ~CEpochDomain() throw()
+	{
+		while (m_pRetired != nullptr)
+		{
+			CRetiredObject* pRetired = m_pRetired;
+			m_pRetired = pRetired->m_pNext;
+			delete pRetired;
+		}
+	}
+
+private:
+	CEpochDomain(const CEpochDomain& domain) = delete;
+
+public:
+	/// <summary>
+	/// Adds a participant to the domain. The participant is offline until `Online` is called.
+	/// </summary>
+	void Register(CEpochParticipant& participant) throw()
+	{
+		CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+		participant.m_llEpoch = 0;
+		participant.m_pNext = m_pParticipants;
+		m_pParticipants = &participant;
+	}
+
+	/// <summary>
+	/// Removes a participant from the domain.
+	/// </summary>
+	void Unregister(CEpochParticipant& participant) throw()
+	{
+		CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+		for (CEpochParticipant** ppParticipant = &m_pParticipants; *ppParticipant != nullptr; ppParticipant = &(*ppParticipant)->m_pNext)
+		{
+			if (*ppParticipant == &participant)
 			{
-				return 1;
+				*ppParticipant = participant.m_pNext;
+				break;
 			}
+		}
 
-			SetEvent(m_hThreadEvent);
-			// Get the request from the IO completion port
-			while (TRUE)
+		participant.m_pNext = nullptr;
+	}
+
+	/// <summary>
+	/// Called by a participant before it starts reading shared data.
+	/// </summary>
+	void Online(CEpochParticipant& participant) throw()
+	{
+		// The full barrier ensures, that no shared data is read before the epoch has been published.
+		::InterlockedExchange64(&participant.m_llEpoch, m_llGlobalEpoch);
+	}
+
+	/// <summary>
+	/// Called by a participant, that does not hold any references to shared data, i.e. between two requests.
+	/// </summary>
+	void Quiesce(CEpochParticipant& participant) throw()
+	{
+		LONG64 llEpoch = m_llGlobalEpoch;
+
+		if (participant.m_llEpoch != llEpoch)
+			::InterlockedExchange64(&participant.m_llEpoch, llEpoch);
+	}
+
+	/// <summary>
+	/// Called by a participant, that does not read shared data for an extended period of time, i.e. before it blocks waiting for work.
+	/// </summary>
+	void Offline(CEpochParticipant& participant) throw()
+	{
+		::InterlockedExchange64(&participant.m_llEpoch, 0);
+	}
+
+	/// <summary>
+	/// Returns `TRUE`, if there are retired objects, that have not yet been destroyed.
+	/// </summary>
+	BOOL HasRetiredObjects() const throw()
+	{
+		return m_lRetired != 0;
+	}
+
+	/// <summary>
+	/// Retires an object, that has already been unlinked from all shared structures, and deletes it after a grace period.
+	/// </summary>
+	template <class T>
+	void Retire(T* object)
+	{
+		this->Retire(object, std::default_delete<T>());
+	}
+
+	/// <summary>
+	/// Retires an object, that has already been unlinked from all shared structures, and passes it to `deleter` after a grace period.
+	/// </summary>
+	template <class T, class TDeleter>
+	void Retire(T* object, TDeleter&& deleter)
+	{
+		CRetiredObject* pRetired = new CRetiredObjectT<T, typename std::decay<TDeleter>::type>(object, std::forward<TDeleter>(deleter));
+
+		// Readers, that observe the new epoch, have started after the object has been unlinked.
+		pRetired->m_llEpoch = ::InterlockedIncrement64(&m_llGlobalEpoch);
+
+		{
+			CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+			pRetired->m_pNext = m_pRetired;
+			m_pRetired = pRetired;
+		}
+
+		if (::InterlockedIncrement(&m_lRetired) % m_lCollectThreshold == 0)
+			this->Collect();
+	}
+
+	/// <summary>
+	/// Destroys all retired objects, whose grace period has elapsed.
+	/// </summary>
+	void Collect() throw()
+	{
+		CRetiredObject* pReclaimable = nullptr;
+		LONG lReclaimed = 0;
+
+		{
+			CComCritSecLock<CComAutoCriticalSection> lock(m_critSec);
+
+			// Get the oldest epoch, that is still observed by an online participant.
+			::MemoryBarrier();
+			LONG64 llOldestEpoch = m_llGlobalEpoch;
+
+			for (CEpochParticipant* pParticipant = m_pParticipants; pParticipant != nullptr; pParticipant = pParticipant->m_pNext)
 			{
-				// Request the queue status.
-				BOOL bStatus = GetQueuedCompletionStatus(m_hRequestQueue, &dwBytesTransfered, &dwCompletionKey, &pOverlapped, INFINITE);
+				LONG64 llEpoch = pParticipant->m_llEpoch;
 
-				if (pOverlapped == ATLS_POOL_SHUTDOWN) // Shut down
-				{
-					LONG bResult = InterlockedExchange(&m_bShutdown, FALSE);
-					if (bResult) // Shutdown has not been cancelled
-						break;
+				if (llEpoch != 0 && llEpoch < llOldestEpoch)
+					llOldestEpoch = llEpoch;
+			}
 
-					// else, shutdown has been cancelled -- continue as before
-				}
-				else if (bStatus)										// Do work
-				{
-					typename TWorker::RequestType request = (typename TWorker::RequestType) dwCompletionKey;
+			for (CRetiredObject** ppRetired = &m_pRetired; *ppRetired != nullptr;)
+			{
+				CRetiredObject* pRetired = *ppRetired;
 
-					// Process the request.  Notice the following:
-					// (1) It is the worker's responsibility to free any memory associated
-					// with the request if the request is complete
-					// (2) If the request still requires some more processing
-					// the worker should queue the request again for dispatching
-					theWorker.Execute(request, m_pvWorkerParam, pOverlapped);
+				if (pRetired->m_llEpoch <= llOldestEpoch)
+				{
+					*ppRetired = pRetired->m_pNext;
+					pRetired->m_pNext = pReclaimable;
+					pReclaimable = pRetired;
+					lReclaimed++;
 				}
 				else
 				{
-					// GetQueuedCompletionStatus returned false (e.g. on application shutdown) and ATLS_POOL_SHUTDOWN has not been set.
-					break;
+					ppRetired = &pRetired->m_pNext;
 				}
 			}
+		}
 
-			theWorker.Terminate(m_pvWorkerParam);
+		::InterlockedExchangeAdd(&m_lRetired, -lReclaimed);
+
+		// Call the deleters outside of the lock.
+		while (pReclaimable != nullptr)
+		{
+			CRetiredObject* pRetired = pReclaimable;
+			pReclaimable = pRetired->m_pNext;
+			delete pRetired;
 		}
+	}
+};
 
-		m_dwThreadEventId = GetCurrentThreadId();
-		SetEvent(m_hThreadEvent);
+/// <summary>
+/// A base class for requests, that embed the link used to queue them.
+/// </summary>
+/// <remarks>
+/// Queueing an intrusive request does not allocate a queue node. Enqueueing and dequeueing only touches the request itself and the head and tail of the queue.
+///
+/// A request can provide a callback, that prefetches the memory it is going to access. When a worker of a
+/// <see cref="CIntrusiveThreadPoolEx">`CIntrusiveThreadPoolEx`</see> takes a request, it calls the callback of the next request in the queue, before it
+/// executes its own. The next request stays in the queue, so the hint does not change, which worker executes it.
+/// </remarks>
+class CIntrusiveRequest
+{
+	friend class CIntrusiveRequestQueue;
 
-		return 0;
+public:
+	/// <summary>
+	/// A function, that prefetches the memory accessed by a request, for example by calling `PrefetchRange` for each of its buffers. It is called while the
+	/// request is locked in its queue, so it must not block or queue requests.
+	/// </summary>
+	typedef void (*PrefetchCallback)(const CIntrusiveRequest* pRequest);
+
+	/// <summary>
+	/// The maximum number of bytes, that are prefetched from the start of a range. Hardware prefetchers follow sequential accesses beyond this point.
+	/// </summary>
+	static const SIZE_T MaxPrefetchBytes = 4096;
+
+private:
+	CIntrusiveRequest* m_pNextRequest;
+	DWORD m_dwTag;
+	volatile LONG m_lCancelled;
+	PrefetchCallback m_pfnPrefetch;
+
+public:
+	CIntrusiveRequest(DWORD dwTag = 0) throw() :
+		m_pNextRequest(nullptr), m_dwTag(dwTag), m_lCancelled(FALSE), m_pfnPrefetch(nullptr)
+	{
+	}
+
+public:
+	/// <summary>
+	/// Prefetches the cache lines of the first `MaxPrefetchBytes` bytes of the range, that starts at `pvAddress` and spans `nBytes` bytes.
+	/// </summary>
+	static void PrefetchRange(const void* pvAddress, SIZE_T nBytes) throw()
+	{
+		SIZE_T nMaxBytes = MaxPrefetchBytes;
+		const BYTE* pFirst = static_cast<const BYTE*>(pvAddress);
+		const BYTE* pLast = pFirst + (std::min)(nBytes, nMaxBytes);
+
+		for (const BYTE* pLine = pFirst - reinterpret_cast<ULONG_PTR>(pFirst) % SYSTEM_CACHE_ALIGNMENT_SIZE; pLine < pLast; pLine += SYSTEM_CACHE_ALIGNMENT_SIZE)
+			PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, pLine);
+	}
+
+public:
+	/// <summary>
+	/// Returns a user-defined tag, that classifies the request.
+	/// </summary>
+	DWORD GetTag() const throw()
+	{
+		return m_dwTag;
 	}
-};
\ No newline at end of file
+
+	/// <summary>
+	/// Sets a user-defined tag, that classifies the request.
+	/// </summary>
+	void SetTag(DWORD dwTag) throw()
+	{
+		m_dwTag = dwTag;
+	}
+
+	/// <summary>
+	/// Marks the request as cancelled. Pools using the <see cref="CCancellationPoolPolicy">`CCancellationPoolPolicy`</see> pass cancelled requests to
+	/// `Cancel` instead of `Execute`, if they have not been started yet.
+	/// </summary>
+	void Cancel() throw()
+	{
+		::InterlockedExchange(&m_lCancelled, TRUE);
+	}
+
+	/// <summary>
+	/// Returns `TRUE`, if the request has been cancelled.
+	/// </summary>
+	BOOL IsCancelled() const throw()
+	{
+		return m_lCancelled != FALSE;
+	}
+
+	/// <summary>
+	/// Clears the cancellation of the request, so that it can be queued again after it has been cancelled.
+	/// </summary>
+	void ResetCancellation() throw()
+	{
+		::InterlockedExchange(&m_lCancelled, FALSE);
+	}
+
+	/// <summary>
+	/// Sets a callback, that prefetches the memory accessed by the request, before it is executed. Pass `nullptr` in order to remove it.
+	/// </summary>
+	void SetPrefetchCallback(PrefetchCallback pfnPrefetch) throw()
+	{
+		m_pfnPrefetch = pfnPrefetch;
+	}
+
+	/// <summary>
+	/// Calls the prefetch callback, if one has been set.
+	/// </summary>
+	void Prefetch() const throw()
+	{
+		if (m_pfnPrefetch != nullptr)
+			m_pfnPrefetch(this);
+	}
+};
+
+/// <summary>
+/// A first-in, first-out queue of <see cref="CIntrusiveRequest">`CIntrusiveRequest`</see> instances.
+/// </summary>
+class CIntrusiveRequestQueue
+{
+private:
+	SRWLOCK m_lock;
+	CIntrusiveRequest* volatile m_pHead;
+	CIntrusiveRequest* m_pTail;
+
+public:
+	CIntrusiveRequestQueue() throw() :
+		m_pHead(nullptr), m_pTail(nullptr)
+	{
+		::InitializeSRWLock(&m_lock);
+	}
+
+private:
+	CIntrusiveRequestQueue(const CIntrusiveRequestQueue& queue) = delete;
+
+public:
+	/// <summary>
+	/// Returns `TRUE`, if there are no requests in the queue.
+	/// </summary>
+	BOOL IsEmpty() const throw()
+	{
+		return m_pHead == nullptr;
+	}
+
+	/// <summary>
+	/// Appends a request to the tail of the queue.
+	/// </summary>
+	void Push(CIntrusiveRequest* request) throw()
+	{
+		request->m_pNextRequest = nullptr;
+
+		::AcquireSRWLockExclusive(&m_lock);
+
+		if (m_pTail != nullptr)
+			m_pTail->m_pNextRequest = request;
+		else
+			m_pHead = request;
+
+		m_pTail = request;
+
+		::ReleaseSRWLockExclusive(&m_lock);
+	}
+
+	/// <summary>
+	/// Removes the request at the head of the queue, or returns `nullptr`, if the queue is empty.
+	/// </summary>
+	CIntrusiveRequest* Pop() throw()
+	{
+		if (this->IsEmpty())
+			return nullptr;
+
+		::AcquireSRWLockExclusive(&m_lock);
+
+		CIntrusiveRequest* pRequest = m_pHead;
+
+		if (pRequest != nullptr)
+		{
+			m_pHead = pRequest->m_pNextRequest;
+
+			if (m_pHead == nullptr)
+				m_pTail = nullptr;
+
+			pRequest->m_pNextRequest = nullptr;
+		}
+
+		::ReleaseSRWLockExclusive(&m_lock);
+
+		return pRequest;
+	}
+
+	/// <summary>
+	/// Removes the request at the head of the queue like `Pop`, and prefetches the memory of the request, that becomes the new head.
+	/// </summary>
+	/// <remarks>
+	/// The new head is prefetched under the lock of the queue, so that it can not be removed and released in the meantime. It stays in the queue, so that any
+	/// worker can take it.
+	/// </remarks>
+	CIntrusiveRequest* PopAndPrefetchNext() throw()
+	{
+		if (this->IsEmpty())
+			return nullptr;
+
+		::AcquireSRWLockExclusive(&m_lock);
+
+		CIntrusiveRequest* pRequest = m_pHead;
+
+		if (pRequest != nullptr)
+		{
+			m_pHead = pRequest->m_pNextRequest;
+
+			if (m_pHead == nullptr)
+				m_pTail = nullptr;
+			else
+				m_pHead->Prefetch();
+
+			pRequest->m_pNextRequest = nullptr;
+		}
+
+		::ReleaseSRWLockExclusive(&m_lock);
+
+		return pRequest;
+	}
+};
+
+/// <summary>
+/// A task of a <see cref="CScopedTaskBatch">`CScopedTaskBatch`</see>, that references a callable object owned by the caller.
+/// </summary>
+class CScopedTask
+{
+private:
+	void (*m_pfnInvoke)(LPVOID pvCallable, ULONG_PTR dwArgument);
+	LPVOID m_pvCallable;
+	ULONG_PTR m_dwArgument;
+
+public:
+	CScopedTask() throw() :
+		m_pfnInvoke(nullptr), m_pvCallable(nullptr), m_dwArgument(0)
+	{
+	}
+
+	/// <summary>
+	/// Initializes a task, that calls `f()`.
+	/// </summary>
+	template <class F>
+	explicit CScopedTask(F& f) throw() :
+		m_pfnInvoke(&CScopedTask::InvokeCallable<F>), m_pvCallable(const_cast<LPVOID>(static_cast<LPCVOID>(&f))), m_dwArgument(0)
+	{
+	}
+
+	/// <summary>
+	/// Initializes a task, that calls `f(dwArgument)`.
+	/// </summary>
+	template <class F>
+	CScopedTask(F& f, ULONG_PTR dwArgument) throw() :
+		m_pfnInvoke(&CScopedTask::InvokeCallableWithArgument<F>), m_pvCallable(const_cast<LPVOID>(static_cast<LPCVOID>(&f))), m_dwArgument(dwArgument)
+	{
+	}
+
+private:
+	template <class F>
+	static void InvokeCallable(LPVOID pvCallable, ULONG_PTR dwArgument)
+	{
+		(*static_cast<F*>(pvCallable))();
+	}
+
+	template <class F>
+	static void InvokeCallableWithArgument(LPVOID pvCallable, ULONG_PTR dwArgument)
+	{
+		(*static_cast<F*>(pvCallable))(dwArgument);
+	}
+
+public:
+	/// <summary>
+	/// Invokes the referenced callable object.
+	/// </summary>
+	void Invoke() const
+	{
+		m_pfnInvoke(m_pvCallable, m_dwArgument);
+	}
+};
+
+/// <summary>
+/// A suspended continuation, that can be resumed by any worker of a <see cref="CScopedTaskScheduler">`CScopedTaskScheduler`</see>.
+/// </summary>
+struct CContinuation
+{
+	void (*m_pfnResume)(LPVOID pvFrame);
+	LPVOID m_pvFrame;
+	ULONG_PTR m_dwKey;
+};
+
+/// <summary>
+/// Stores the stealable continuations of a single worker.
+/// </summary>
+/// <remarks>
+/// The owner pushes and removes continuations at the back, thieves steal the oldest continuation from the front. In a divide-and-conquer computation the oldest
+/// continuation represents the largest amount of remaining work, so that a single steal keeps the thief busy for a long time.
+/// </remarks>
+class CContinuationDeque
+{
+private:
+	SRWLOCK m_lock;
+	std::deque<CContinuation> m_continuations;
+
+public:
+	CContinuationDeque() throw()
+	{
+		::InitializeSRWLock(&m_lock);
+	}
+
+private:
+	CContinuationDeque(const CContinuationDeque& deque) = delete;
+
+public:
+	/// <summary>
+	/// Pushes a continuation to the back of the deque.
+	/// </summary>
+	void Push(const CContinuation& continuation)
+	{
+		::AcquireSRWLockExclusive(&m_lock);
+		m_continuations.push_back(continuation);
+		::ReleaseSRWLockExclusive(&m_lock);
+	}
+
+	/// <summary>
+	/// Removes the continuation with the key `dwKey`. Returns `FALSE`, if it has already been stolen.
+	/// </summary>
+	/// <remarks>
+	/// The continuation is usually the last one in the deque, so that it is searched from the back.
+	/// </remarks>
+	BOOL Remove(ULONG_PTR dwKey) throw()
+	{
+		BOOL bRemoved = FALSE;
+
+		::AcquireSRWLockExclusive(&m_lock);
+
+		for (auto it = m_continuations.rbegin(); it != m_continuations.rend(); ++it)
+		{
+			if (it->m_dwKey == dwKey)
+			{
+				m_continuations.erase(std::next(it).base());
+				bRemoved = TRUE;
+				break;
+			}
+		}
+
+		::ReleaseSRWLockExclusive(&m_lock);
+
+		return bRemoved;
+	}
+
+	/// <summary>
+	/// Steals the oldest continuation. Returns `FALSE`, if the deque is empty.
+	/// </summary>
+	BOOL Steal(CContinuation& continuation) throw()
+	{
+		BOOL bStolen = FALSE;
+
+		::AcquireSRWLockExclusive(&m_lock);
+
+		if (!m_continuations.empty())
+		{
+			continuation = m_continuations.front();
+			m_continuations.pop_front();
+			bStolen = TRUE;
+		}
+
+		::ReleaseSRWLockExclusive(&m_lock);
+
+		return bStolen;
+	}
+};
+
+class CScopedTaskBatchBase;
+
+/// <summary>
+/// Dispatches the tasks of open <see cref="CScopedTaskBatch">`CScopedTaskBatch`</see> instances to worker threads.
+/// </summary>
+/// <remarks>
+/// Batches with unclaimed tasks are linked into a queue. Workers claim tasks under a lock, that is also taken by the batch before it returns, so that no worker
+/// can reference a batch after it has been destroyed. The scheduler is implemented by `CThreadPoolEx`.
+/// </remarks>
+class CScopedTaskScheduler
+{
+	friend class CScopedTaskBatchBase;
+
+private:
+	/// <summary>
+	/// Stores the worker index and scratch memory of the current thread.
+	/// </summary>
+	struct CThreadState
+	{
+		const CScopedTaskScheduler* m_pScheduler;
+		int m_nWorkerIndex;
+		std::unique_ptr<BYTE[]> m_scratch;
+		SIZE_T m_nScratchSize;
+		CContinuationDeque* m_pContinuations;
+
+		CThreadState() throw() :
+			m_pScheduler(nullptr), m_nWorkerIndex(-1), m_nScratchSize(0), m_pContinuations(nullptr)
+		{
+		}
+	};
+
+private:
+	SRWLOCK m_lock;
+	CScopedTaskBatchBase* volatile m_pHead;
+	CScopedTaskBatchBase* m_pTail;
+	SRWLOCK m_workerLock;
+	std::vector<BOOL> m_workerIndices;
+	std::vector<std::unique_ptr<CContinuationDeque>> m_continuations;
+	CContinuationDeque m_externalContinuations;
+	volatile LONG m_lContinuations;
+
+public:
+	CScopedTaskScheduler() throw() :
+		m_pHead(nullptr), m_pTail(nullptr), m_lContinuations(0)
+	{
+		::InitializeSRWLock(&m_lock);
+		::InitializeSRWLock(&m_workerLock);
+	}
+
+	virtual ~CScopedTaskScheduler() throw()
+	{
+	}
+
+private:
+	CScopedTaskScheduler(const CScopedTaskScheduler& scheduler) = delete;
+
+	static CThreadState& GetThreadState() throw()
+	{
+		static thread_local CThreadState s_state;
+
+		return s_state;
+	}
+
+public:
+	/// <summary>
+	/// Returns the number of workers, that execute scoped tasks.
+	/// </summary>
+	virtual int GetConcurrency() throw() = 0;
+
+	/// <summary>
+	/// Returns the index of the calling worker, or `-1`, if the calling thread is not a worker of this scheduler.
+	/// </summary>
+	/// <remarks>
+	/// Worker indices are dense and reused after a worker exits, so they can be used to address per-worker data. All indices are less than `GetWorkerIndexLimit`.
+	/// </remarks>
+	int GetCurrentWorkerIndex() const throw()
+	{
+		const CThreadState& state = GetThreadState();
+
+		return state.m_pScheduler == this ? state.m_nWorkerIndex : -1;
+	}
+
+	/// <summary>
+	/// Returns an upper bound for the indices of all workers, that have been started so far.
+	/// </summary>
+	int GetWorkerIndexLimit() throw()
+	{
+		::AcquireSRWLockShared(&m_workerLock);
+		int nLimit = static_cast<int>(m_workerIndices.size());
+		::ReleaseSRWLockShared(&m_workerLock);
+
+		return nLimit;
+	}
+
+	/// <summary>
+	/// Returns a scratch buffer of at least `nSize` bytes, that is owned by the calling thread and released when it exits.
+	/// </summary>
+	/// <remarks>
+	/// The buffer is reused by subsequent calls on the same thread, which do not preserve its contents. It can be used for temporary data of a task, like hash
+	/// tables, without allocating memory each time a task is executed.
+	/// </remarks>
+	static LPVOID GetScratchBuffer(SIZE_T nSize)
+	{
+		CThreadState& state = GetThreadState();
+
+		if (state.m_nScratchSize < nSize)
+		{
+			state.m_scratch.reset();
+			state.m_scratch.reset(new BYTE[nSize]);
+			state.m_nScratchSize = nSize;
+		}
+
+		return state.m_scratch.get();
+	}
+
+	/// <summary>
+	/// Returns the continuation deque of the calling worker, or a shared deque, if the calling thread is not a worker of this scheduler.
+	/// </summary>
+	CContinuationDeque& GetContinuationDeque() throw()
+	{
+		const CThreadState& state = GetThreadState();
+
+		return state.m_pScheduler == this ? *state.m_pContinuations : m_externalContinuations;
+	}
+
+	/// <summary>
+	/// Makes a continuation stealable by other workers.
+	/// </summary>
+	void PushContinuation(CContinuationDeque& deque, const CContinuation& continuation)
+	{
+		deque.Push(continuation);
+		::InterlockedIncrement(&m_lContinuations);
+		this->WakeIdleWorker();
+	}
+
+	/// <summary>
+	/// Takes back a continuation, that has been pushed to `deque`. Returns `FALSE`, if it has been stolen, in which case the thief resumes it.
+	/// </summary>
+	BOOL RemoveContinuation(CContinuationDeque& deque, ULONG_PTR dwKey) throw()
+	{
+		if (!deque.Remove(dwKey))
+			return FALSE;
+
+		::InterlockedDecrement(&m_lContinuations);
+		return TRUE;
+	}
+
+protected:
+	/// <summary>
+	/// Called by a worker thread when it starts, in order to acquire a worker index.
+	/// </summary>
+	int EnterWorker() throw()
+	{
+		::AcquireSRWLockExclusive(&m_workerLock);
+
+		SIZE_T nIndex = std::find(m_workerIndices.begin(), m_workerIndices.end(), FALSE) - m_workerIndices.begin();
+
+		if (nIndex == m_workerIndices.size())
+		{
+			m_workerIndices.push_back(TRUE);
+			m_continuations.emplace_back(new CContinuationDeque());
+		}
+		else
+			m_workerIndices[nIndex] = TRUE;
+
+		CContinuationDeque* pContinuations = m_continuations[nIndex].get();
+
+		::ReleaseSRWLockExclusive(&m_workerLock);
+
+		CThreadState& state = GetThreadState();
+		state.m_pScheduler = this;
+		state.m_nWorkerIndex = static_cast<int>(nIndex);
+		state.m_pContinuations = pContinuations;
+
+		return state.m_nWorkerIndex;
+	}
+
+	/// <summary>
+	/// Called by a worker thread before it exits, in order to release its worker index.
+	/// </summary>
+	void LeaveWorker() throw()
+	{
+		CThreadState& state = GetThreadState();
+
+		::AcquireSRWLockExclusive(&m_workerLock);
+		m_workerIndices[state.m_nWorkerIndex] = FALSE;
+		::ReleaseSRWLockExclusive(&m_workerLock);
+
+		state.m_pScheduler = nullptr;
+		state.m_nWorkerIndex = -1;
+		state.m_pContinuations = nullptr;
+	}
+
+protected:
+	/// <summary>
+	/// Called after a task has been added to a batch, in order to wake up a worker, that executes it.
+	/// </summary>
+	virtual void WakeIdleWorker() throw() = 0;
+
+	/// <summary>
+	/// Returns `TRUE`, if there are unclaimed scoped tasks.
+	/// </summary>
+	BOOL HasScopedTasks() const throw()
+	{
+		return m_pHead != nullptr;
+	}
+
+	/// <summary>
+	/// Claims and executes a scoped task. Returns `FALSE`, if there are no unclaimed tasks.
+	/// </summary>
+	inline BOOL DispatchScopedTask() throw();
+
+	/// <summary>
+	/// Returns `TRUE`, if there are continuations, that can be stolen.
+	/// </summary>
+	BOOL HasContinuations() const throw()
+	{
+		return m_lContinuations != 0;
+	}
+
+	/// <summary>
+	/// Steals and resumes a continuation. Returns `FALSE`, if there are no stealable continuations.
+	/// </summary>
+	inline BOOL DispatchContinuation() throw();
+
+public:
+	/// <summary>
+	/// Executes a scoped task or resumes a stolen continuation. Returns `FALSE`, if there is neither. Workers call it while they wait for other tasks.
+	/// </summary>
+	BOOL DispatchPendingTask() throw()
+	{
+		return this->DispatchScopedTask() || this->DispatchContinuation();
+	}
+
+private:
+	inline void SubmitTask(CScopedTaskBatchBase& batch) throw();
+	inline BOOL ClaimTask(CScopedTaskBatchBase* batch, CScopedTask& task, CScopedTaskBatchBase*& owner) throw();
+	inline void Unlink(CScopedTaskBatchBase& batch) throw();
+};
+
+/// <summary>
+/// Implements <see cref="CScopedTaskBatch">`CScopedTaskBatch`</see> on top of task storage provided by the derived class.
+/// </summary>
+class CScopedTaskBatchBase
+{
+	friend class CScopedTaskScheduler;
+
+private:
+	/// <summary>
+	/// An auto-reset event, that is cached for each thread, that waits for batches.
+	/// </summary>
+	struct CThreadEvent
+	{
+		HANDLE m_hEvent;
+
+		CThreadEvent() throw() :
+			m_hEvent(::CreateEvent(nullptr, FALSE, FALSE, nullptr))
+		{
+		}
+
+		~CThreadEvent() throw()
+		{
+			if (m_hEvent != nullptr)
+				::CloseHandle(m_hEvent);
+		}
+	};
+
+private:
+	CScopedTaskScheduler& m_scheduler;
+	CScopedTask* m_pTasks;
+	SIZE_T m_nCapacity;
+	SIZE_T m_nTasks;
+	SIZE_T m_nNextTask;
+	volatile LONG m_lPending;
+	HANDLE m_hEvent;
+	BOOL m_bLinked;
+	CScopedTaskBatchBase* m_pNextBatch;
+	CScopedTaskBatchBase* m_pPreviousBatch;
+
+protected:
+	CScopedTaskBatchBase(CScopedTaskScheduler& scheduler, CScopedTask* tasks, SIZE_T nCapacity) throw() :
+		m_scheduler(scheduler), m_pTasks(tasks), m_nCapacity(nCapacity), m_nTasks(0), m_nNextTask(0), m_lPending(1), m_hEvent(GetThreadEvent()),
+		m_bLinked(FALSE), m_pNextBatch(nullptr), m_pPreviousBatch(nullptr)
+	{
+	}
+
+private:
+	CScopedTaskBatchBase(const CScopedTaskBatchBase& batch) = delete;
+
+	static HANDLE GetThreadEvent() throw()
+	{
+		static thread_local CThreadEvent s_event;
+
+		return s_event.m_hEvent;
+	}
+
+	void AddTask(const CScopedTask& task) throw()
+	{
+		if (m_nTasks == m_nCapacity)
+		{
+			// There's no storage left for the task, so execute it on the calling thread.
+			task.Invoke();
+			return;
+		}
+
+		m_pTasks[m_nTasks] = task;
+		::InterlockedIncrement(&m_lPending);
+
+		m_scheduler.SubmitTask(*this);
+	}
+
+	void Complete() throw()
+	{
+		// Read the event before the batch may be released by the waiting thread.
+		HANDLE hEvent = m_hEvent;
+
+		if (::InterlockedDecrement(&m_lPending) == 0)
+			::SetEvent(hEvent);
+	}
+
+public:
+	/// <summary>
+	/// Returns the scheduler, that executes the tasks of the batch.
+	/// </summary>
+	CScopedTaskScheduler& GetScheduler() const throw()
+	{
+		return m_scheduler;
+	}
+
+	/// <summary>
+	/// Submits a task, that calls `f()`. `f` must not be destroyed before the batch has been waited for.
+	/// </summary>
+	template <class F>
+	void Run(F& f) throw()
+	{
+		this->AddTask(CScopedTask(f));
+	}
+
+	/// <summary>
+	/// Submits a task, that calls `f(dwArgument)`. `f` must not be destroyed before the batch has been waited for.
+	/// </summary>
+	template <class F>
+	void Run(F& f, ULONG_PTR dwArgument) throw()
+	{
+		this->AddTask(CScopedTask(f, dwArgument));
+	}
+
+	/// <summary>
+	/// Waits until all submitted tasks have been executed. Tasks, that have not yet been claimed by a worker, are executed by the calling thread.
+	/// </summary>
+	/// <remarks>
+	/// Since the caller executes unclaimed tasks itself, batches can safely be nested within tasks, that are executed by the same pool.
+	/// </remarks>
+	void Wait() throw()
+	{
+		CScopedTask task;
+		CScopedTaskBatchBase* pOwner;
+
+		while (m_scheduler.ClaimTask(this, task, pOwner))
+		{
+			task.Invoke();
+			::InterlockedDecrement(&m_lPending);
+		}
+
+		if (::InterlockedDecrement(&m_lPending) != 0)
+		{
+			if (m_hEvent != nullptr)
+				::WaitForSingleObject(m_hEvent, INFINITE);
+			else
+				while (m_lPending != 0)
+					::SwitchToThread();
+		}
+
+		// Reset the batch, so that it can be reused.
+		m_lPending = 1;
+		m_nTasks = 0;
+		m_nNextTask = 0;
+	}
+};
+
+/// <summary>
+/// A batch of tasks, that reference callable objects on the caller's stack, and are executed by the workers of a pool, without allocating any memory.
+/// </summary>
+/// <remarks>
+/// The destructor waits until all tasks have been executed, so the callable objects only need to live as long as the batch. If more than `nCapacity` tasks are
+/// submitted, the remaining tasks are executed directly by the calling thread. A batch must be used and destroyed on the thread, that created it.
+/// </remarks>
+template <SIZE_T nCapacity = 64>
+class CScopedTaskBatch :
+	public CScopedTaskBatchBase
+{
+public:
+	static const SIZE_T Capacity = nCapacity;
+
+private:
+	CScopedTask m_tasks[nCapacity];
+
+public:
+	explicit CScopedTaskBatch(CScopedTaskScheduler& scheduler) throw() :
+		CScopedTaskBatchBase(scheduler, m_tasks, nCapacity)
+	{
+	}
+
+	~CScopedTaskBatch() throw()
+	{
+		// Wait here, since the tasks are destroyed before the base class destructor runs.
+		this->Wait();
+	}
+};
+
+void CScopedTaskScheduler::SubmitTask(CScopedTaskBatchBase& batch) throw()
+{
+	::AcquireSRWLockExclusive(&m_lock);
+
+	batch.m_nTasks++;
+
+	if (!batch.m_bLinked)
+	{
+		batch.m_bLinked = TRUE;
+		batch.m_pNextBatch = nullptr;
+		batch.m_pPreviousBatch = m_pTail;
+
+		if (m_pTail != nullptr)
+			m_pTail->m_pNextBatch = &batch;
+		else
+			m_pHead = &batch;
+
+		m_pTail = &batch;
+	}
+
+	::ReleaseSRWLockExclusive(&m_lock);
+
+	this->WakeIdleWorker();
+}
+
+BOOL CScopedTaskScheduler::ClaimTask(CScopedTaskBatchBase* batch, CScopedTask& task, CScopedTaskBatchBase*& owner) throw()
+{
+	if (batch == nullptr && m_pHead == nullptr)
+		return FALSE;
+
+	::AcquireSRWLockExclusive(&m_lock);
+
+	owner = batch != nullptr ? batch : m_pHead;
+
+	BOOL bClaimed = owner != nullptr && owner->m_nNextTask < owner->m_nTasks;
+
+	if (bClaimed)
+		task = owner->m_pTasks[owner->m_nNextTask++];
+
+	// Remove the batch from the queue, as soon as all of its tasks have been claimed.
+	if (owner != nullptr && owner->m_bLinked && owner->m_nNextTask == owner->m_nTasks)
+		this->Unlink(*owner);
+
+	::ReleaseSRWLockExclusive(&m_lock);
+
+	return bClaimed;
+}
+
+void CScopedTaskScheduler::Unlink(CScopedTaskBatchBase& batch) throw()
+{
+	if (batch.m_pPreviousBatch != nullptr)
+		batch.m_pPreviousBatch->m_pNextBatch = batch.m_pNextBatch;
+	else
+		m_pHead = batch.m_pNextBatch;
+
+	if (batch.m_pNextBatch != nullptr)
+		batch.m_pNextBatch->m_pPreviousBatch = batch.m_pPreviousBatch;
+	else
+		m_pTail = batch.m_pPreviousBatch;
+
+	batch.m_bLinked = FALSE;
+	batch.m_pNextBatch = nullptr;
+	batch.m_pPreviousBatch = nullptr;
+}
+
+BOOL CScopedTaskScheduler::DispatchScopedTask() throw()
+{
+	CScopedTask task;
+	CScopedTaskBatchBase* pOwner;
+
+	if (!this->ClaimTask(nullptr, task, pOwner))
+		return FALSE;
+
+	task.Invoke();
+	pOwner->Complete();
+
+	return TRUE;
+}
+
+BOOL CScopedTaskScheduler::DispatchContinuation() throw()
+{
+	if (m_lContinuations == 0)
+		return FALSE;
+
+	CContinuation continuation;
+	BOOL bStolen = m_externalContinuations.Steal(continuation);
+
+	if (!bStolen)
+	{
+		// Start with the deque of the next worker, so that thieves spread over the victims.
+		::AcquireSRWLockShared(&m_workerLock);
+
+		SIZE_T nDeques = m_continuations.size();
+		SIZE_T nFirst = static_cast<SIZE_T>(this->GetCurrentWorkerIndex() + 1);
+
+		for (SIZE_T i = 0; i < nDeques && !bStolen; ++i)
+			bStolen = m_continuations[(nFirst + i) % nDeques]->Steal(continuation);
+
+		::ReleaseSRWLockShared(&m_workerLock);
+	}
+
+	if (!bStolen)
+		return FALSE;
+
+	::InterlockedDecrement(&m_lContinuations);
+	continuation.m_pfnResume(continuation.m_pvFrame);
+
+	return TRUE;
+}
+
+/// <summary>
+/// Executes all provided callable objects in parallel and returns after all of them have finished.
+/// </summary>
+template <class ... F>
+void ParallelInvoke(CScopedTaskScheduler& scheduler, F&& ... functions)
+{
+	CScopedTaskBatch<sizeof...(F)> batch(scheduler);
+
+	int expand[] = { (batch.Run(functions), 0) ... };
+	(void)expand;
+}
+
+/// <summary>
+/// Calls `body(nChunkFirst, nChunkLast)` in parallel for consecutive chunks of `nGrainSize` indices, that cover the range [`nFirst`, `nLast`).
+/// </summary>
+/// <remarks>
+/// The calling thread and one task per worker claim chunks from a shared counter, until the range is exhausted. No memory is allocated. If `nGrainSize` is `0`,
+/// the range is split into about eight chunks per worker.
+/// </remarks>
+template <class TBody>
+void ParallelFor(CScopedTaskScheduler& scheduler, SIZE_T nFirst, SIZE_T nLast, const TBody& body, SIZE_T nGrainSize = 0)
+{
+	if (nFirst >= nLast)
+		return;
+
+	SIZE_T nCount = nLast - nFirst;
+	SIZE_T nWorkers = static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1));
+
+	if (nGrainSize == 0)
+		nGrainSize = (std::max)(nCount / (nWorkers * 8), static_cast<SIZE_T>(1));
+
+	SIZE_T nChunks = (nCount + nGrainSize - 1) / nGrainSize;
+
+	if (nChunks == 1)
+	{
+		body(nFirst, nLast);
+		return;
+	}
+
+	volatile LONG64 llNextChunk = 0;
+
+	auto loop = [&]() {
+		for (LONG64 llChunk = ::InterlockedIncrement64(&llNextChunk) - 1; static_cast<SIZE_T>(llChunk) < nChunks; llChunk = ::InterlockedIncrement64(&llNextChunk) - 1)
+		{
+			SIZE_T nChunkFirst = nFirst + static_cast<SIZE_T>(llChunk) * nGrainSize;
+			body(nChunkFirst, (std::min)(nChunkFirst + nGrainSize, nLast));
+		}
+	};
+
+	CScopedTaskBatch<> batch(scheduler);
+
+	for (SIZE_T nTask = 0, nTasks = (std::min)(nWorkers, nChunks - 1); nTask < nTasks; nTask++)
+		batch.Run(loop);
+
+	// The calling thread claims chunks as well.
+	loop();
+}
+
+/// <summary>
+/// Calls `body(nPartFirst, nPartLast)` in parallel for one contiguous part of the range [`nFirst`, `nLast`) per worker, so that a worker processes the same part
+/// each time the loop is repeated over a range of the same size.
+/// </summary>
+/// <remarks>
+/// The range is split into `GetConcurrency() + 1` parts of equal size, but not more than one part per task of a `CScopedTaskBatch<>` plus one, so that the
+/// claims are tracked without allocating memory. The part with index `i` belongs to the worker with index `i`, and the last part belongs to the calling thread,
+/// if it is not a worker, as well as to workers with higher indices. Each task processes the part of the worker it runs on first, and then claims the parts,
+/// that have not been claimed yet, so the loop completes, even if some workers are busy. Use it instead of `ParallelFor` for data, that is placed by the
+/// thread, that touches it first, like the elements of a <see cref="CFirstTouchArray">`CFirstTouchArray`</see>.
+/// </remarks>
+template <class TBody>
+void ParallelForStatic(CScopedTaskScheduler& scheduler, SIZE_T nFirst, SIZE_T nLast, const TBody& body)
+{
+	if (nFirst >= nLast)
+		return;
+
+	static const SIZE_T MaxParts = CScopedTaskBatch<>::Capacity + 1;
+
+	SIZE_T nCount = nLast - nFirst;
+	SIZE_T nParts = (std::min)((std::min)(static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1)) + 1, MaxParts), nCount);
+
+	if (nParts == 1)
+	{
+		body(nFirst, nLast);
+		return;
+	}
+
+	volatile LONG claimed[MaxParts] = {};
+
+	auto process = [&](SIZE_T nPart) {
+		if (claimed[nPart] == FALSE && ::InterlockedExchange(&claimed[nPart], TRUE) == FALSE)
+			body(nFirst + nCount * nPart / nParts, nFirst + nCount * (nPart + 1) / nParts);
+	};
+
+	auto loop = [&]() {
+		int nWorkerIndex = scheduler.GetCurrentWorkerIndex();
+		SIZE_T nOwnPart = nWorkerIndex >= 0 && static_cast<SIZE_T>(nWorkerIndex) < nParts - 1 ? static_cast<SIZE_T>(nWorkerIndex) : nParts - 1;
+
+		process(nOwnPart);
+
+		for (SIZE_T nPart = 1; nPart < nParts; nPart++)
+			process((nOwnPart + nPart) % nParts);
+	};
+
+	CScopedTaskBatch<> batch(scheduler);
+
+	for (SIZE_T nTask = 0; nTask < nParts - 1; nTask++)
+		batch.Run(loop);
+
+	loop();
+}
+
+/// <summary>
+/// Calls `body(nChunkFirst, nChunkLast)` in parallel for chunks of about equal cost, that cover the range [`nFirst`, `nLast`), where
+/// `pCumulativeCosts[k]` is the total cost of the indices [`nFirst`, `nFirst + k`).
+/// </summary>
+/// <remarks>
+/// `pCumulativeCosts` must provide `nLast - nFirst + 1` non-decreasing entries, and only differences between them are evaluated, so the row offsets of a
+/// sparse matrix in CSR format can be passed directly. The range is split into eight chunks of equal cost per worker, whose bounds are found by a binary search
+/// when a chunk is claimed. Chunks are claimed from a shared counter like in `ParallelFor`, which balances the remaining imbalance between the estimated and
+/// actual costs. A single index with a cost above the cost of a chunk forms a chunk on its own.
+/// </remarks>
+template <class TBody, class TCost>
+void ParallelForCumulativeCost(CScopedTaskScheduler& scheduler, SIZE_T nFirst, SIZE_T nLast, const TBody& body, const TCost* pCumulativeCosts)
+{
+	if (nFirst >= nLast)
+		return;
+
+	SIZE_T nCount = nLast - nFirst;
+	SIZE_T nWorkers = static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1));
+	SIZE_T nChunks = (std::min)(nWorkers * 8, nCount);
+
+	double dFirstCost = static_cast<double>(pCumulativeCosts[0]);
+	double dTotalCost = static_cast<double>(pCumulativeCosts[nCount]) - dFirstCost;
+
+	// Without any costs, the chunks would not be balanced at all.
+	if (dTotalCost <= 0.0)
+	{
+		ParallelFor(scheduler, nFirst, nLast, body);
+		return;
+	}
+
+	// Returns the first index of a chunk, which is the first index, that starts at or after the chunk's share of the total cost.
+	auto getChunkStart = [&](SIZE_T nChunk) -> SIZE_T {
+		if (nChunk == 0)
+			return 0;
+
+		if (nChunk == nChunks)
+			return nCount;
+
+		double dTarget = dFirstCost + dTotalCost * static_cast<double>(nChunk) / static_cast<double>(nChunks);
+
+		return static_cast<SIZE_T>(std::lower_bound(pCumulativeCosts, pCumulativeCosts + nCount, dTarget, [](const TCost& cost, double dCost) {
+			return static_cast<double>(cost) < dCost;
+		}) - pCumulativeCosts);
+	};
+
+	volatile LONG64 llNextChunk = 0;
+
+	auto loop = [&]() {
+		for (LONG64 llChunk = ::InterlockedIncrement64(&llNextChunk) - 1; static_cast<SIZE_T>(llChunk) < nChunks; llChunk = ::InterlockedIncrement64(&llNextChunk) - 1)
+		{
+			SIZE_T nChunkFirst = getChunkStart(static_cast<SIZE_T>(llChunk));
+			SIZE_T nChunkLast = getChunkStart(static_cast<SIZE_T>(llChunk) + 1);
+
+			if (nChunkFirst < nChunkLast)
+				body(nFirst + nChunkFirst, nFirst + nChunkLast);
+		}
+	};
+
+	if (nChunks == 1)
+	{
+		loop();
+		return;
+	}
+
+	CScopedTaskBatch<> batch(scheduler);
+
+	for (SIZE_T nTask = 0, nTasks = (std::min)(nWorkers, nChunks - 1); nTask < nTasks; nTask++)
+		batch.Run(loop);
+
+	// The calling thread claims chunks as well.
+	loop();
+}
+
+/// <summary>
+/// Calls `body(nChunkFirst, nChunkLast)` in parallel for chunks of about equal cost, that cover the range [`nFirst`, `nLast`), where `costOf(i)` returns the
+/// estimated cost of the index `i`.
+/// </summary>
+/// <remarks>
+/// The costs are evaluated once per index and summed up by a parallel prefix sum over one block per worker, before the range is split by
+/// <see cref="ParallelForCumulativeCost">`ParallelForCumulativeCost`</see>.
+/// </remarks>
+template <class TBody, class TCostOf>
+void ParallelForWeighted(CScopedTaskScheduler& scheduler, SIZE_T nFirst, SIZE_T nLast, const TBody& body, const TCostOf& costOf)
+{
+	if (nFirst >= nLast)
+		return;
+
+	SIZE_T nCount = nLast - nFirst;
+	SIZE_T nBlocks = (std::max)((std::min)(static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1)) + 1, nCount / 4096), static_cast<SIZE_T>(1));
+
+	std::vector<double> cumulativeCosts(nCount + 1);
+	std::vector<double> blockCosts(nBlocks + 1, 0.0);
+
+	// Sum up the costs of each block, while storing the cost of each index behind it.
+	ParallelFor(scheduler, 0, nBlocks, [&](SIZE_T nFirstBlock, SIZE_T nLastBlock) {
+		for (SIZE_T nBlock = nFirstBlock; nBlock < nLastBlock; nBlock++)
+		{
+			double dCost = 0.0;
+
+			for (SIZE_T i = nCount * nBlock / nBlocks, nBlockLast = nCount * (nBlock + 1) / nBlocks; i < nBlockLast; i++)
+				dCost += cumulativeCosts[i + 1] = static_cast<double>(costOf(nFirst + i));
+
+			blockCosts[nBlock + 1] = dCost;
+		}
+	}, 1);
+
+	for (SIZE_T nBlock = 0; nBlock < nBlocks; nBlock++)
+		blockCosts[nBlock + 1] += blockCosts[nBlock];
+
+	// Turn the costs into cumulative costs, starting at the total cost of the preceding blocks.
+	ParallelFor(scheduler, 0, nBlocks, [&](SIZE_T nFirstBlock, SIZE_T nLastBlock) {
+		for (SIZE_T nBlock = nFirstBlock; nBlock < nLastBlock; nBlock++)
+		{
+			double dCost = blockCosts[nBlock];
+
+			for (SIZE_T i = nCount * nBlock / nBlocks, nBlockLast = nCount * (nBlock + 1) / nBlocks; i < nBlockLast; i++)
+				cumulativeCosts[i + 1] = dCost += cumulativeCosts[i + 1];
+		}
+	}, 1);
+
+	cumulativeCosts[0] = 0.0;
+
+	ParallelForCumulativeCost(scheduler, nFirst, nLast, body, cumulativeCosts.data());
+}
+
+/// <summary>
+/// Adapts the grain size of parallel loops at a call site, so that each chunk takes about a target duration.
+/// </summary>
+/// <remarks>
+/// Declare the tuner as a static local variable next to the loop, so that the tuned grain size is remembered for subsequent runs of the same loop. The tuner
+/// starts with chunks of a single index and doubles their size, until a chunk takes long enough to be measured reliably. Afterwards it maintains an
+/// exponentially weighted average of the time per index, from which the grain size is derived. Loops time each chunk, until the average is based on
+/// `ConvergedSamples` samples, and only the first chunk of each task afterwards, so that the estimate follows changes of the workload.
+/// </remarks>
+class CGrainSizeTuner
+{
+public:
+	/// <summary>
+	/// The number of samples, after which loops stop timing every chunk.
+	/// </summary>
+	static const LONG ConvergedSamples = 8;
+
+private:
+	SRWLOCK m_lock;
+	double m_dTargetTicks;
+	double m_dTicksPerIndex;
+	volatile LONG m_lSamples;
+	volatile SIZE_T m_nGrainSize;
+
+public:
+	/// <summary>
+	/// Initializes a tuner, that targets chunks of `dwTargetMicroseconds` each.
+	/// </summary>
+	explicit CGrainSizeTuner(DWORD dwTargetMicroseconds = 75) throw() :
+		m_dTicksPerIndex(0.0), m_lSamples(0), m_nGrainSize(1)
+	{
+		::InitializeSRWLock(&m_lock);
+
+		LARGE_INTEGER frequency;
+		::QueryPerformanceFrequency(&frequency);
+		m_dTargetTicks = static_cast<double>(frequency.QuadPart) * dwTargetMicroseconds / 1000000.0;
+	}
+
+private:
+	CGrainSizeTuner(const CGrainSizeTuner& tuner) = delete;
+
+public:
+	/// <summary>
+	/// Returns a timestamp, that can be passed to `Record` after a chunk has been executed.
+	/// </summary>
+	static LONGLONG GetTimestamp() throw()
+	{
+		LARGE_INTEGER counter;
+		::QueryPerformanceCounter(&counter);
+
+		return counter.QuadPart;
+	}
+
+	/// <summary>
+	/// Returns the current grain size.
+	/// </summary>
+	SIZE_T GetGrainSize() const throw()
+	{
+		return m_nGrainSize;
+	}
+
+	/// <summary>
+	/// Returns `TRUE`, if the grain size is based on enough samples, so that loops only need to time a few chunks.
+	/// </summary>
+	BOOL IsConverged() const throw()
+	{
+		return m_lSamples >= ConvergedSamples;
+	}
+
+	/// <summary>
+	/// Records the execution time of a chunk of `nIndices` indices, that has been started at `llStart`.
+	/// </summary>
+	void Record(SIZE_T nIndices, LONGLONG llStart) throw()
+	{
+		double dTicks = static_cast<double>(GetTimestamp() - llStart);
+
+		::AcquireSRWLockExclusive(&m_lock);
+
+		if (m_lSamples == 0 && dTicks * 8.0 < m_dTargetTicks)
+		{
+			// The chunk has been too short to be measured reliably, so probe with larger chunks first.
+			m_nGrainSize = (std::max)(static_cast<SIZE_T>(m_nGrainSize), nIndices * 2);
+		}
+		else
+		{
+			double dTicksPerIndex = dTicks / static_cast<double>(nIndices);
+
+			m_dTicksPerIndex = m_lSamples == 0 ? dTicksPerIndex : m_dTicksPerIndex + 0.25 * (dTicksPerIndex - m_dTicksPerIndex);
+			m_nGrainSize = m_dTicksPerIndex * 2.0 < m_dTargetTicks ? static_cast<SIZE_T>(m_dTargetTicks / m_dTicksPerIndex) : 1;
+
+			if (m_lSamples < ConvergedSamples)
+				m_lSamples++;
+		}
+
+		::ReleaseSRWLockExclusive(&m_lock);
+	}
+};
+
+/// <summary>
+/// Calls `body(nChunkFirst, nChunkLast)` in parallel for consecutive chunks of indices, that cover the range [`nFirst`, `nLast`), with a grain size, that is
+/// adapted by `tuner`.
+/// </summary>
+/// <remarks>
+/// Chunks are claimed from a shared counter, like in the overload with a fixed grain size, but each claim uses the current grain size of the tuner, so that
+/// the grain size is adapted while the first run of the loop is executed. The grain size is limited to an equal share of the range for each worker.
+/// </remarks>
+template <class TBody>
+void ParallelFor(CScopedTaskScheduler& scheduler, SIZE_T nFirst, SIZE_T nLast, const TBody& body, CGrainSizeTuner& tuner)
+{
+	if (nFirst >= nLast)
+		return;
+
+	SIZE_T nCount = nLast - nFirst;
+	SIZE_T nWorkers = static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1));
+	SIZE_T nMaxGrainSize = (nCount + nWorkers - 1) / nWorkers;
+
+	volatile LONG64 llNextIndex = 0;
+
+	auto loop = [&]() {
+		for (BOOL bFirstChunk = TRUE; ; bFirstChunk = FALSE)
+		{
+			SIZE_T nGrainSize = (std::min)(tuner.GetGrainSize(), nMaxGrainSize);
+			SIZE_T nChunkFirst = static_cast<SIZE_T>(::InterlockedExchangeAdd64(&llNextIndex, static_cast<LONG64>(nGrainSize)));
+
+			if (nChunkFirst >= nCount)
+				break;
+
+			nChunkFirst += nFirst;
+			SIZE_T nChunkLast = (std::min)(nChunkFirst + nGrainSize, nLast);
+
+			if (bFirstChunk || !tuner.IsConverged())
+			{
+				LONGLONG llStart = CGrainSizeTuner::GetTimestamp();
+				body(nChunkFirst, nChunkLast);
+				tuner.Record(nChunkLast - nChunkFirst, llStart);
+			}
+			else
+			{
+				body(nChunkFirst, nChunkLast);
+			}
+		}
+	};
+
+	if (nCount == 1)
+	{
+		loop();
+		return;
+	}
+
+	CScopedTaskBatch<> batch(scheduler);
+
+	for (SIZE_T nTask = 0, nTasks = (std::min)(nWorkers, nCount - 1); nTask < nTasks; nTask++)
+		batch.Run(loop);
+
+	// The calling thread claims chunks as well.
+	loop();
+}
+
+/// <summary>
+/// An array, whose pages are placed on the NUMA nodes of the workers, that process them in loops with <see cref="ParallelForStatic">`ParallelForStatic`</see>.
+/// </summary>
+/// <remarks>
+/// Windows places a page on the node of the thread, that touches it first, so an array, that is initialized by a single thread, ends up on a single node. This
+/// array is allocated with `VirtualAlloc` and its elements are constructed with `ParallelForStatic`, so that subsequent loops with `ParallelForStatic` over the
+/// same number of elements find each part on the node of the worker, that processes it.
+///
+/// Large pages are backed by physical memory as soon as they are allocated, so they can not be placed by the first touch. If they are requested, the node of
+/// the worker, that processes each part, is determined first, and the large pages are allocated on these nodes at consecutive addresses. A large page, that is
+/// shared by two parts, is placed on the node of the part, that contains its first byte. Large pages require the `SeLockMemoryPrivilege`. If they can not be
+/// allocated, regular pages are used instead.
+/// </remarks>
+///
+/// <seealso cref="https://docs.microsoft.com/en-us/windows/win32/memory/large-page-support">Large-Page Support</seealso>
+template <class T>
+class CFirstTouchArray
+{
+private:
+	CScopedTaskScheduler* m_pScheduler;
+	T* m_pElements;
+	SIZE_T m_nCount;
+	std::vector<LPVOID> m_allocations;
+	BOOL m_bLargePages;
+
+public:
+	CFirstTouchArray() throw() :
+		m_pScheduler(nullptr), m_pElements(nullptr), m_nCount(0), m_bLargePages(FALSE)
+	{
+	}
+
+	~CFirstTouchArray() throw()
+	{
+		this->Free();
+	}
+
+private:
+	CFirstTouchArray(const CFirstTouchArray& array) = delete;
+
+	void Release() throw()
+	{
+		for (LPVOID pvAllocation : m_allocations)
+			::VirtualFree(pvAllocation, 0, MEM_RELEASE);
+
+		m_allocations.clear();
+	}
+
+	BYTE* AllocateLargePages(CScopedTaskScheduler& scheduler, SIZE_T nCount)
+	{
+		SIZE_T nPageSize = ::GetLargePageMinimum();
+
+		if (nPageSize == 0)
+			return nullptr;
+
+		SIZE_T nBytes = nCount * sizeof(T);
+		SIZE_T nPages = (nBytes + nPageSize - 1) / nPageSize;
+		std::vector<USHORT> nodes(nPages);
+
+		// Each part records its node for the pages, that start within it.
+		ParallelForStatic(scheduler, 0, nCount, [&](SIZE_T nFirst, SIZE_T nLast) {
+			PROCESSOR_NUMBER processor;
+			USHORT nNode;
+
+			::GetCurrentProcessorNumberEx(&processor);
+
+			if (!::GetNumaProcessorNodeEx(&processor, &nNode))
+				nNode = 0;
+
+			for (SIZE_T nPage = (nFirst * sizeof(T) + nPageSize - 1) / nPageSize; nPage * nPageSize < nLast * sizeof(T); nPage++)
+				nodes[nPage] = nNode;
+		});
+
+		// The address range is reserved and released again, in order to find free addresses, which might be taken by another thread in the meantime.
+		for (int nAttempt = 0; nAttempt < 4; nAttempt++)
+		{
+			BYTE* pReserved = static_cast<BYTE*>(::VirtualAlloc(nullptr, (nPages + 1) * nPageSize, MEM_RESERVE, PAGE_READWRITE));
+
+			if (pReserved == nullptr)
+				return nullptr;
+
+			::VirtualFree(pReserved, 0, MEM_RELEASE);
+
+			BYTE* pBase = pReserved + (nPageSize - reinterpret_cast<ULONG_PTR>(pReserved) % nPageSize) % nPageSize;
+			SIZE_T nPage = 0;
+
+			// Consecutive pages on the same node are allocated at once.
+			while (nPage < nPages)
+			{
+				SIZE_T nRunLast = nPage + 1;
+
+				while (nRunLast < nPages && nodes[nRunLast] == nodes[nPage])
+					nRunLast++;
+
+				LPVOID pvAllocation = ::VirtualAllocExNuma(::GetCurrentProcess(), pBase + nPage * nPageSize, (nRunLast - nPage) * nPageSize,
+					MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, nodes[nPage]);
+
+				if (pvAllocation == nullptr)
+					break;
+
+				m_allocations.push_back(pvAllocation);
+				nPage = nRunLast;
+			}
+
+			if (nPage == nPages)
+				return pBase;
+
+			DWORD dwError = ::GetLastError();
+			this->Release();
+
+			// Only retry, if the addresses have been taken, and not if large pages are not available at all.
+			if (dwError != ERROR_INVALID_ADDRESS)
+				return nullptr;
+		}
+
+		return nullptr;
+	}
+
+public:
+	/// <summary>
+	/// Allocates `nCount` elements and constructs the element with the index `i` from `initialize(i)` on the worker, that processes it in
+	/// `ParallelForStatic`. Any previously allocated elements are freed. If `bLargePages` is `TRUE`, large pages are used, if they are available.
+	/// </summary>
+	template <class TInitializer>
+	HRESULT Allocate(CScopedTaskScheduler& scheduler, SIZE_T nCount, const TInitializer& initialize, BOOL bLargePages = FALSE)
+	{
+		this->Free();
+
+		if (nCount == 0)
+			return S_OK;
+
+		if (nCount > static_cast<SIZE_T>(-1) / sizeof(T))
+			return E_OUTOFMEMORY;
+
+		BYTE* pBase = bLargePages ? this->AllocateLargePages(scheduler, nCount) : nullptr;
+		m_bLargePages = pBase != nullptr;
+
+		if (pBase == nullptr)
+		{
+			pBase = static_cast<BYTE*>(::VirtualAlloc(nullptr, nCount * sizeof(T), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+
+			if (pBase == nullptr)
+				return AtlHresultFromLastError();
+
+			m_allocations.push_back(pBase);
+		}
+
+		m_pScheduler = &scheduler;
+		m_pElements = reinterpret_cast<T*>(pBase);
+		m_nCount = nCount;
+
+		ParallelForStatic(scheduler, 0, nCount, [&](SIZE_T nFirst, SIZE_T nLast) {
+			for (SIZE_T i = nFirst; i < nLast; i++)
+				new (m_pElements + i) T(initialize(i));
+		});
+
+		return S_OK;
+	}
+
+	/// <summary>
+	/// Allocates `nCount` value-initialized elements. Any previously allocated elements are freed.
+	/// </summary>
+	HRESULT Allocate(CScopedTaskScheduler& scheduler, SIZE_T nCount, BOOL bLargePages = FALSE)
+	{
+		return this->Allocate(scheduler, nCount, [](SIZE_T) { return T(); }, bLargePages);
+	}
+
+	/// <summary>
+	/// Destroys the elements and releases their memory.
+	/// </summary>
+	/// <remarks>
+	/// The elements are destroyed in parallel by <see cref="ParallelForStatic">`ParallelForStatic`</see>, which does not allocate memory, so freeing does not
+	/// throw, as long as the destructor of `T` does not.
+	/// </remarks>
+	void Free() throw()
+	{
+		if (m_pElements != nullptr && !std::is_trivially_destructible<T>::value)
+			ParallelForStatic(*m_pScheduler, 0, m_nCount, [this](SIZE_T nFirst, SIZE_T nLast) {
+				for (SIZE_T i = nFirst; i < nLast; i++)
+					m_pElements[i].~T();
+			});
+
+		this->Release();
+
+		m_pScheduler = nullptr;
+		m_pElements = nullptr;
+		m_nCount = 0;
+		m_bLargePages = FALSE;
+	}
+
+	/// <summary>
+	/// Returns the elements, or `nullptr`, if no elements have been allocated.
+	/// </summary>
+	T* GetData() const throw()
+	{
+		return m_pElements;
+	}
+
+	/// <summary>
+	/// Returns the number of elements.
+	/// </summary>
+	SIZE_T GetCount() const throw()
+	{
+		return m_nCount;
+	}
+
+	/// <summary>
+	/// Returns `TRUE`, if the elements are stored in large pages.
+	/// </summary>
+	BOOL HasLargePages() const throw()
+	{
+		return m_bLargePages;
+	}
+
+	/// <summary>
+	/// Returns the element with the index `nIndex`.
+	/// </summary>
+	T& operator[](SIZE_T nIndex) throw()
+	{
+		return m_pElements[nIndex];
+	}
+
+	/// <summary>
+	/// Returns the element with the index `nIndex`.
+	/// </summary>
+	const T& operator[](SIZE_T nIndex) const throw()
+	{
+		return m_pElements[nIndex];
+	}
+};
+
+/// <summary>
+/// Provides the sizes of the data caches of the current machine.
+/// </summary>
+class CCacheInfo
+{
+private:
+	SIZE_T m_nCacheSize[4];
+	SIZE_T m_nCacheLineSize;
+
+private:
+	CCacheInfo() throw() :
+		m_nCacheLineSize(SYSTEM_CACHE_ALIGNMENT_SIZE)
+	{
+		// Use common sizes, if the cache topology cannot be detected.
+		m_nCacheSize[0] = 0;
+		m_nCacheSize[1] = 32 * 1024;
+		m_nCacheSize[2] = 256 * 1024;
+		m_nCacheSize[3] = 8 * 1024 * 1024;
+
+		DWORD dwLength = 0;
+
+		if (::GetLogicalProcessorInformation(nullptr, &dwLength) || ::GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+			return;
+
+		std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> information(dwLength / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+
+		if (!::GetLogicalProcessorInformation(information.data(), &dwLength))
+			return;
+
+		for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& entry : information)
+		{
+			if (entry.Relationship != RelationCache || entry.Cache.Level < 1 || entry.Cache.Level > 3)
+				continue;
+
+			if (entry.Cache.Type != CacheData && entry.Cache.Type != CacheUnified)
+				continue;
+
+			m_nCacheSize[entry.Cache.Level] = entry.Cache.Size;
+			m_nCacheLineSize = entry.Cache.LineSize;
+		}
+	}
+
+	static const CCacheInfo& GetInstance() throw()
+	{
+		static const CCacheInfo s_instance;
+
+		return s_instance;
+	}
+
+public:
+	/// <summary>
+	/// Returns the size of a single data cache of the provided level (1 to 3) in bytes.
+	/// </summary>
+	static SIZE_T GetDataCacheSize(UINT nLevel) throw()
+	{
+		return GetInstance().m_nCacheSize[(std::min)((std::max)(nLevel, 1U), 3U)];
+	}
+
+	/// <summary>
+	/// Returns the size of a cache line in bytes.
+	/// </summary>
+	static SIZE_T GetCacheLineSize() throw()
+	{
+		return GetInstance().m_nCacheLineSize;
+	}
+};
+
+/// <summary>
+/// A multi-dimensional range of indices. Dimension `0` is the innermost one, i.e. the one, that is contiguous in memory.
+/// </summary>
+template <UINT nDimensions>
+struct CBlockedRange
+{
+	SIZE_T m_nFirst[nDimensions];
+	SIZE_T m_nLast[nDimensions];
+
+	/// <summary>
+	/// Returns the number of indices along a dimension.
+	/// </summary>
+	SIZE_T GetSize(UINT nDimension) const throw()
+	{
+		return m_nLast[nDimension] > m_nFirst[nDimension] ? m_nLast[nDimension] - m_nFirst[nDimension] : 0;
+	}
+};
+
+typedef CBlockedRange<2> CBlockedRange2D;
+typedef CBlockedRange<3> CBlockedRange3D;
+
+/// <summary>
+/// The order, in which the tiles of a multi-dimensional parallel loop are handed out to workers.
+/// </summary>
+enum class TileOrder
+{
+	/// <summary>
+	/// Tiles are enumerated along the innermost dimension first.
+	/// </summary>
+	RowMajor,
+
+	/// <summary>
+	/// Tiles are enumerated along a Z-order curve.
+	/// </summary>
+	Morton,
+
+	/// <summary>
+	/// Tiles are enumerated along a Hilbert curve. Three-dimensional loops use the Morton order instead.
+	/// </summary>
+	Hilbert
+};
+
+/// <summary>
+/// Describes how a multi-dimensional parallel loop splits its range into tiles.
+/// </summary>
+/// <remarks>
+/// By default, the range is split along its largest dimension, until the data touched by a tile fits into half of the L2 cache of a worker. Set `m_nTileSize`
+/// for a dimension in order to override the automatic tile size for it, or `m_nCacheSize` in order to target a different footprint.
+/// </remarks>
+struct CTilingOptions
+{
+	/// <summary>
+	/// The number of bytes, that are touched for each index of the range, summed over all arrays accessed by the loop body.
+	/// </summary>
+	SIZE_T m_nElementSize;
+
+	/// <summary>
+	/// The cache level, whose size limits the footprint of a tile.
+	/// </summary>
+	UINT m_nCacheLevel;
+
+	/// <summary>
+	/// The footprint of a tile in bytes, or `0` to derive it from the size of the cache at `m_nCacheLevel`.
+	/// </summary>
+	SIZE_T m_nCacheSize;
+
+	/// <summary>
+	/// The size of a tile along each dimension, or `0` to compute it automatically.
+	/// </summary>
+	SIZE_T m_nTileSize[3];
+
+	/// <summary>
+	/// The order, in which tiles are handed out to workers.
+	/// </summary>
+	TileOrder m_order;
+
+	CTilingOptions(SIZE_T nElementSize = sizeof(double), TileOrder order = TileOrder::RowMajor) throw() :
+		m_nElementSize(nElementSize), m_nCacheLevel(2), m_nCacheSize(0), m_order(order)
+	{
+		m_nTileSize[0] = m_nTileSize[1] = m_nTileSize[2] = 0;
+	}
+};
+
+/// <summary>
+/// Implements the tiling of multi-dimensional parallel loops.
+/// </summary>
+class CTiling
+{
+public:
+	/// <summary>
+	/// Computes the tile sizes for a range, by halving the largest dimension until a tile fits into the cache and there are enough tiles for all workers.
+	/// </summary>
+	template <UINT nDimensions>
+	static void ComputeTileSize(const CBlockedRange<nDimensions>& range, const CTilingOptions& options, SIZE_T nWorkers, SIZE_T (&nTileSize)[nDimensions]) throw()
+	{
+		SIZE_T nCacheSize = options.m_nCacheSize != 0 ? options.m_nCacheSize : CCacheInfo::GetDataCacheSize(options.m_nCacheLevel) / 2;
+		SIZE_T nElementSize = (std::max)(options.m_nElementSize, static_cast<SIZE_T>(1));
+
+		// Keep at least a cache line of contiguous elements in each row of a tile.
+		SIZE_T nMinimumRow = (std::max)(CCacheInfo::GetCacheLineSize() / nElementSize, static_cast<SIZE_T>(1));
+
+		for (UINT d = 0; d < nDimensions; d++)
+			nTileSize[d] = options.m_nTileSize[d] != 0 ? options.m_nTileSize[d] : (std::max)(range.GetSize(d), static_cast<SIZE_T>(1));
+
+		while (TRUE)
+		{
+			SIZE_T nFootprint = nElementSize, nTiles = 1;
+
+			for (UINT d = 0; d < nDimensions; d++)
+			{
+				nFootprint *= nTileSize[d];
+				nTiles *= (range.GetSize(d) + nTileSize[d] - 1) / nTileSize[d];
+			}
+
+			if (nFootprint <= nCacheSize && nTiles >= nWorkers * 4)
+				break;
+
+			// Split the largest dimension, that has not been fixed by the caller. Outer dimensions are preferred on ties, to keep rows contiguous.
+			UINT nSplit = nDimensions;
+
+			for (UINT d = nDimensions; d-- > 0;)
+			{
+				if (options.m_nTileSize[d] != 0 || nTileSize[d] <= 1 || (d == 0 && nTileSize[d] <= nMinimumRow))
+					continue;
+
+				if (nSplit == nDimensions || nTileSize[d] > nTileSize[nSplit])
+					nSplit = d;
+			}
+
+			if (nSplit == nDimensions)
+				break;
+
+			nTileSize[nSplit] = (nTileSize[nSplit] + 1) / 2;
+		}
+	}
+
+	/// <summary>
+	/// Interleaves the bits of the tile coordinates.
+	/// </summary>
+	template <UINT nDimensions>
+	static ULONGLONG GetMortonKey(const SIZE_T (&nTile)[nDimensions]) throw()
+	{
+		ULONGLONG ullKey = 0;
+
+		for (UINT nBit = 0; nBit < 64 / nDimensions; nBit++)
+			for (UINT d = 0; d < nDimensions; d++)
+				ullKey |= static_cast<ULONGLONG>((nTile[d] >> nBit) & 1) << (nBit * nDimensions + d);
+
+		return ullKey;
+	}
+
+	/// <summary>
+	/// Returns the distance of a tile along a Hilbert curve, that covers a square grid of `nSide` tiles, where `nSide` is a power of two.
+	/// </summary>
+	static ULONGLONG GetHilbertKey(SIZE_T nSide, SIZE_T nX, SIZE_T nY) throw()
+	{
+		ULONGLONG ullKey = 0;
+
+		for (SIZE_T s = nSide / 2; s > 0; s /= 2)
+		{
+			SIZE_T rx = (nX & s) != 0 ? 1 : 0;
+			SIZE_T ry = (nY & s) != 0 ? 1 : 0;
+
+			ullKey += static_cast<ULONGLONG>(s) * s * ((3 * rx) ^ ry);
+
+			// Rotate the quadrant.
+			if (ry == 0)
+			{
+				if (rx == 1)
+				{
+					nX = nSide - 1 - nX;
+					nY = nSide - 1 - nY;
+				}
+
+				std::swap(nX, nY);
+			}
+		}
+
+		return ullKey;
+	}
+
+	/// <summary>
+	/// Executes `body` in parallel for each tile of `range`.
+	/// </summary>
+	template <UINT nDimensions, class TBody>
+	static void ParallelForTiles(CScopedTaskScheduler& scheduler, const CBlockedRange<nDimensions>& range, const TBody& body, const CTilingOptions& options)
+	{
+		SIZE_T nTileSize[nDimensions], nTileCount[nDimensions], nTiles = 1;
+
+		for (UINT d = 0; d < nDimensions; d++)
+			if (range.GetSize(d) == 0)
+				return;
+
+		CTiling::ComputeTileSize(range, options, static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1)), nTileSize);
+
+		for (UINT d = 0; d < nDimensions; d++)
+		{
+			nTileCount[d] = (range.GetSize(d) + nTileSize[d] - 1) / nTileSize[d];
+			nTiles *= nTileCount[d];
+		}
+
+		// Space-filling orders are implemented as a permutation of the row-major tile indices.
+		std::vector<std::pair<ULONGLONG, SIZE_T>> order;
+
+		if (options.m_order != TileOrder::RowMajor)
+		{
+			SIZE_T nSide = 1;
+
+			while (nSide < (std::max)(nTileCount[0], nTileCount[nDimensions - 1]) || (nDimensions > 2 && nSide < nTileCount[1]))
+				nSide *= 2;
+
+			order.reserve(nTiles);
+
+			for (SIZE_T nIndex = 0; nIndex < nTiles; nIndex++)
+			{
+				SIZE_T nTile[nDimensions];
+				CTiling::GetTile(nIndex, nTileCount, nTile);
+
+				ULONGLONG ullKey = options.m_order == TileOrder::Hilbert && nDimensions == 2 ?
+					CTiling::GetHilbertKey(nSide, nTile[0], nTile[nDimensions - 1]) :
+					CTiling::GetMortonKey(nTile);
+
+				order.push_back(std::make_pair(ullKey, nIndex));
+			}
+
+			std::sort(order.begin(), order.end());
+		}
+
+		ParallelFor(scheduler, 0, nTiles, [&](SIZE_T nFirst, SIZE_T nLast) {
+			for (SIZE_T n = nFirst; n < nLast; n++)
+			{
+				SIZE_T nTile[nDimensions];
+				CTiling::GetTile(order.empty() ? n : order[n].second, nTileCount, nTile);
+
+				CBlockedRange<nDimensions> tile;
+
+				for (UINT d = 0; d < nDimensions; d++)
+				{
+					tile.m_nFirst[d] = range.m_nFirst[d] + nTile[d] * nTileSize[d];
+					tile.m_nLast[d] = (std::min)(tile.m_nFirst[d] + nTileSize[d], range.m_nLast[d]);
+				}
+
+				body(tile);
+			}
+		}, 1);
+	}
+
+private:
+	template <UINT nDimensions>
+	static void GetTile(SIZE_T nIndex, const SIZE_T (&nTileCount)[nDimensions], SIZE_T (&nTile)[nDimensions]) throw()
+	{
+		for (UINT d = 0; d < nDimensions; d++)
+		{
+			nTile[d] = nIndex % nTileCount[d];
+			nIndex /= nTileCount[d];
+		}
+	}
+};
+
+/// <summary>
+/// Calls `body(tile)` in parallel for cache-sized tiles of a two-dimensional range, where `tile` is a <see cref="CBlockedRange">`CBlockedRange2D`</see>.
+/// </summary>
+template <class TBody>
+void ParallelFor2D(CScopedTaskScheduler& scheduler, const CBlockedRange2D& range, const TBody& body, const CTilingOptions& options = CTilingOptions())
+{
+	CTiling::ParallelForTiles(scheduler, range, body, options);
+}
+
+/// <summary>
+/// Calls `body(tile)` in parallel for cache-sized tiles of a three-dimensional range, where `tile` is a <see cref="CBlockedRange">`CBlockedRange3D`</see>.
+/// </summary>
+template <class TBody>
+void ParallelFor3D(CScopedTaskScheduler& scheduler, const CBlockedRange3D& range, const TBody& body, const CTilingOptions& options = CTilingOptions())
+{
+	CTiling::ParallelForTiles(scheduler, range, body, options);
+}
+
+/// <summary>
+/// The result of <see cref="ParallelHashPartition">`ParallelHashPartition`</see>: the input elements, reordered so that each partition is stored contiguously.
+/// </summary>
+template <class T>
+class CHashPartitions
+{
+public:
+	std::vector<T> m_elements;
+	std::vector<SIZE_T> m_offsets;
+
+public:
+	/// <summary>
+	/// Returns the number of partitions.
+	/// </summary>
+	SIZE_T GetPartitionCount() const throw()
+	{
+		return m_offsets.empty() ? 0 : m_offsets.size() - 1;
+	}
+
+	/// <summary>
+	/// Returns the number of elements within a partition.
+	/// </summary>
+	SIZE_T GetPartitionSize(SIZE_T nPartition) const throw()
+	{
+		return m_offsets[nPartition + 1] - m_offsets[nPartition];
+	}
+
+	/// <summary>
+	/// Returns a pointer to the first element of a partition.
+	/// </summary>
+	const T* GetPartition(SIZE_T nPartition) const throw()
+	{
+		return m_elements.data() + m_offsets[nPartition];
+	}
+};
+
+/// <summary>
+/// Implements the building blocks of hash-partitioned parallel algorithms.
+/// </summary>
+class CHashPartitioning
+{
+public:
+	/// <summary>
+	/// Mixes the bits of a hash value, so that both its upper and lower bits are well distributed. The upper bits select the partition, the lower bits are
+	/// used for the hash tables within a partition.
+	/// </summary>
+	static ULONGLONG MixHash(ULONGLONG ullHash) throw()
+	{
+		ullHash ^= ullHash >> 33;
+		ullHash *= 0xff51afd7ed558ccdULL;
+		ullHash ^= ullHash >> 33;
+		ullHash *= 0xc4ceb9fe1a85ec53ULL;
+		ullHash ^= ullHash >> 33;
+
+		return ullHash;
+	}
+
+	/// <summary>
+	/// Returns the partition of a mixed hash value.
+	/// </summary>
+	static SIZE_T GetPartition(ULONGLONG ullMixedHash, UINT nPartitionBits) throw()
+	{
+		return nPartitionBits == 0 ? 0 : static_cast<SIZE_T>(ullMixedHash >> (64 - nPartitionBits));
+	}
+
+	/// <summary>
+	/// Returns the number of partition bits, so that a partition fits into the L2 cache and there are several partitions per worker.
+	/// </summary>
+	static UINT GetDefaultPartitionBits(SIZE_T nCount, SIZE_T nElementSize, SIZE_T nWorkers) throw()
+	{
+		SIZE_T nPartitions = (std::max)((nCount * nElementSize) / (std::max)(CCacheInfo::GetDataCacheSize(2), static_cast<SIZE_T>(1)), nWorkers * 4);
+		UINT nBits = 0;
+
+		// More partitions than this make the scatter phase thrash the TLB.
+		while ((static_cast<SIZE_T>(1) << nBits) < nPartitions && nBits < 12)
+			nBits++;
+
+		return nBits;
+	}
+
+	/// <summary>
+	/// Returns a power of two, that is at least twice as large as `nCount`.
+	/// </summary>
+	static SIZE_T GetTableSize(SIZE_T nCount) throw()
+	{
+		SIZE_T nSize = 1;
+
+		while (nSize < nCount * 2)
+			nSize *= 2;
+
+		return nSize;
+	}
+};
+
+/// <summary>
+/// Reorders `nCount` elements in parallel, so that all elements, whose keys hash to the same partition, are stored contiguously.
+/// </summary>
+/// <remarks>
+/// The input is split into one block per worker. Each block is counted into its own histogram, an exclusive prefix sum over all histograms yields a disjoint
+/// output range for each block and partition, and each block finally scatters its elements into these ranges. The order of the elements within a partition is
+/// stable. If `nPartitionBits` is `0`, the number of partitions is chosen, so that each partition fits into the L2 cache.
+/// </remarks>
+template <class T, class TKeyOf, class THash>
+void ParallelHashPartition(CScopedTaskScheduler& scheduler, const T* pInput, SIZE_T nCount, CHashPartitions<T>& partitions, const TKeyOf& keyOf, const THash& hash, UINT nPartitionBits = 0)
+{
+	SIZE_T nWorkers = static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1));
+
+	if (nPartitionBits == 0)
+		nPartitionBits = CHashPartitioning::GetDefaultPartitionBits(nCount, sizeof(T), nWorkers);
+
+	SIZE_T nPartitions = static_cast<SIZE_T>(1) << nPartitionBits;
+	SIZE_T nBlocks = (std::max)((std::min)(nWorkers + 1, nCount / 4096), static_cast<SIZE_T>(1));
+
+	partitions.m_elements.resize(nCount);
+	partitions.m_offsets.assign(nPartitions + 1, 0);
+
+	std::vector<SIZE_T> histograms(nBlocks * nPartitions, 0);
+
+	// Count the elements of each block and partition.
+	ParallelFor(scheduler, 0, nBlocks, [&](SIZE_T nFirstBlock, SIZE_T nLastBlock) {
+		for (SIZE_T nBlock = nFirstBlock; nBlock < nLastBlock; nBlock++)
+		{
+			SIZE_T* pHistogram = &histograms[nBlock * nPartitions];
+
+			for (SIZE_T i = nCount * nBlock / nBlocks, nLast = nCount * (nBlock + 1) / nBlocks; i < nLast; i++)
+				pHistogram[CHashPartitioning::GetPartition(CHashPartitioning::MixHash(hash(keyOf(pInput[i]))), nPartitionBits)]++;
+		}
+	}, 1);
+
+	// Turn the histograms into the output positions of each block within each partition.
+	SIZE_T nOffset = 0;
+
+	for (SIZE_T nPartition = 0; nPartition < nPartitions; nPartition++)
+	{
+		partitions.m_offsets[nPartition] = nOffset;
+
+		for (SIZE_T nBlock = 0; nBlock < nBlocks; nBlock++)
+		{
+			SIZE_T nSize = histograms[nBlock * nPartitions + nPartition];
+			histograms[nBlock * nPartitions + nPartition] = nOffset;
+			nOffset += nSize;
+		}
+	}
+
+	partitions.m_offsets[nPartitions] = nOffset;
+
+	// Scatter the elements into their partitions.
+	ParallelFor(scheduler, 0, nBlocks, [&](SIZE_T nFirstBlock, SIZE_T nLastBlock) {
+		for (SIZE_T nBlock = nFirstBlock; nBlock < nLastBlock; nBlock++)
+		{
+			SIZE_T* pPositions = &histograms[nBlock * nPartitions];
+
+			for (SIZE_T i = nCount * nBlock / nBlocks, nLast = nCount * (nBlock + 1) / nBlocks; i < nLast; i++)
+				partitions.m_elements[pPositions[CHashPartitioning::GetPartition(CHashPartitioning::MixHash(hash(keyOf(pInput[i]))), nPartitionBits)]++] = pInput[i];
+		}
+	}, 1);
+}
+
+/// <summary>
+/// Groups `nCount` elements by their key in parallel, and calls `accumulate(aggregate, element)` for each element, in order to compute an aggregate per group.
+/// </summary>
+/// <remarks>
+/// The elements are hash-partitioned first. Each partition is then aggregated by a single worker, using an open-addressing hash table, that is stored in the
+/// worker's scratch buffer. `result` receives one pair of key and aggregate per group, ordered by partition. Aggregates are value-initialized before the first
+/// element of a group is accumulated.
+/// </remarks>
+template <class T, class TKey, class TAggregate, class TKeyOf, class TAccumulate, class THash>
+void ParallelGroupBy(CScopedTaskScheduler& scheduler, const T* pInput, SIZE_T nCount, std::vector<std::pair<TKey, TAggregate>>& result, const TKeyOf& keyOf, const TAccumulate& accumulate, const THash& hash, UINT nPartitionBits = 0)
+{
+	CHashPartitions<T> partitions;
+	ParallelHashPartition(scheduler, pInput, nCount, partitions, keyOf, hash, nPartitionBits);
+
+	SIZE_T nPartitions = partitions.GetPartitionCount();
+	std::vector<std::vector<std::pair<TKey, TAggregate>>> groups(nPartitions);
+
+	ParallelFor(scheduler, 0, nPartitions, [&](SIZE_T nFirstPartition, SIZE_T nLastPartition) {
+		for (SIZE_T nPartition = nFirstPartition; nPartition < nLastPartition; nPartition++)
+		{
+			const T* pElements = partitions.GetPartition(nPartition);
+			SIZE_T nElements = partitions.GetPartitionSize(nPartition);
+			std::vector<std::pair<TKey, TAggregate>>& partitionGroups = groups[nPartition];
+
+			// The table stores the index of a group plus one, so that zero marks an empty slot.
+			SIZE_T nTableSize = CHashPartitioning::GetTableSize(nElements);
+			SIZE_T* pTable = static_cast<SIZE_T*>(CScopedTaskScheduler::GetScratchBuffer(nTableSize * sizeof(SIZE_T)));
+			std::fill(pTable, pTable + nTableSize, static_cast<SIZE_T>(0));
+
+			for (SIZE_T i = 0; i < nElements; i++)
+			{
+				const TKey& key = keyOf(pElements[i]);
+				SIZE_T nSlot = static_cast<SIZE_T>(CHashPartitioning::MixHash(hash(key))) & (nTableSize - 1);
+
+				while (pTable[nSlot] != 0 && !(partitionGroups[pTable[nSlot] - 1].first == key))
+					nSlot = (nSlot + 1) & (nTableSize - 1);
+
+				if (pTable[nSlot] == 0)
+				{
+					partitionGroups.push_back(std::make_pair(key, TAggregate()));
+					pTable[nSlot] = partitionGroups.size();
+				}
+
+				accumulate(partitionGroups[pTable[nSlot] - 1].second, pElements[i]);
+			}
+		}
+	}, 1);
+
+	// Concatenate the groups of all partitions.
+	std::vector<SIZE_T> offsets(nPartitions + 1, 0);
+
+	for (SIZE_T nPartition = 0; nPartition < nPartitions; nPartition++)
+		offsets[nPartition + 1] = offsets[nPartition] + groups[nPartition].size();
+
+	result.clear();
+	result.resize(offsets[nPartitions]);
+
+	ParallelFor(scheduler, 0, nPartitions, [&](SIZE_T nFirstPartition, SIZE_T nLastPartition) {
+		for (SIZE_T nPartition = nFirstPartition; nPartition < nLastPartition; nPartition++)
+			std::move(groups[nPartition].begin(), groups[nPartition].end(), result.begin() + offsets[nPartition]);
+	}, 1);
+}
+
+/// <summary>
+/// Groups `nCount` elements by their key in parallel, using `std::hash` to hash the keys.
+/// </summary>
+template <class T, class TKey, class TAggregate, class TKeyOf, class TAccumulate>
+void ParallelGroupBy(CScopedTaskScheduler& scheduler, const T* pInput, SIZE_T nCount, std::vector<std::pair<TKey, TAggregate>>& result, const TKeyOf& keyOf, const TAccumulate& accumulate)
+{
+	ParallelGroupBy(scheduler, pInput, nCount, result, keyOf, accumulate, std::hash<TKey>());
+}
+
+/// <summary>
+/// Joins two arrays on equal keys in parallel, and calls `match(nPartition, buildElement, probeElement)` for each pair of matching elements.
+/// </summary>
+/// <remarks>
+/// Both inputs are hash-partitioned with the same number of partitions. Each pair of partitions is then joined by a single worker, which builds a chained hash
+/// table over the build partition within its scratch buffer and probes it with the elements of the probe partition. Calls for the same partition are never
+/// concurrent, so `nPartition` can be used to address per-partition output without synchronization. Use the smaller input as the build side.
+/// </remarks>
+template <class TBuild, class TProbe, class TBuildKeyOf, class TProbeKeyOf, class TMatch, class THash>
+void ParallelHashJoin(CScopedTaskScheduler& scheduler, const TBuild* pBuild, SIZE_T nBuild, const TProbe* pProbe, SIZE_T nProbe, const TBuildKeyOf& buildKeyOf, const TProbeKeyOf& probeKeyOf, const TMatch& match, const THash& hash, UINT nPartitionBits = 0)
+{
+	if (nPartitionBits == 0)
+		nPartitionBits = CHashPartitioning::GetDefaultPartitionBits(nBuild, sizeof(TBuild) + 2 * sizeof(SIZE_T), static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1)));
+
+	CHashPartitions<TBuild> buildPartitions;
+	CHashPartitions<TProbe> probePartitions;
+
+	ParallelHashPartition(scheduler, pBuild, nBuild, buildPartitions, buildKeyOf, hash, nPartitionBits);
+	ParallelHashPartition(scheduler, pProbe, nProbe, probePartitions, probeKeyOf, hash, nPartitionBits);
+
+	ParallelFor(scheduler, 0, buildPartitions.GetPartitionCount(), [&](SIZE_T nFirstPartition, SIZE_T nLastPartition) {
+		for (SIZE_T nPartition = nFirstPartition; nPartition < nLastPartition; nPartition++)
+		{
+			const TBuild* pBuildElements = buildPartitions.GetPartition(nPartition);
+			SIZE_T nBuildElements = buildPartitions.GetPartitionSize(nPartition);
+
+			if (nBuildElements == 0 || probePartitions.GetPartitionSize(nPartition) == 0)
+				continue;
+
+			// The table stores the index of the first element of a bucket plus one, the chain links each element to the next one in its bucket.
+			SIZE_T nTableSize = CHashPartitioning::GetTableSize(nBuildElements);
+			SIZE_T* pTable = static_cast<SIZE_T*>(CScopedTaskScheduler::GetScratchBuffer((nTableSize + nBuildElements) * sizeof(SIZE_T)));
+			SIZE_T* pChain = pTable + nTableSize;
+			std::fill(pTable, pTable + nTableSize, static_cast<SIZE_T>(0));
+
+			for (SIZE_T i = 0; i < nBuildElements; i++)
+			{
+				SIZE_T nSlot = static_cast<SIZE_T>(CHashPartitioning::MixHash(hash(buildKeyOf(pBuildElements[i])))) & (nTableSize - 1);
+				pChain[i] = pTable[nSlot];
+				pTable[nSlot] = i + 1;
+			}
+
+			const TProbe* pProbeElements = probePartitions.GetPartition(nPartition);
+
+			for (SIZE_T i = 0, nProbeElements = probePartitions.GetPartitionSize(nPartition); i < nProbeElements; i++)
+			{
+				const auto& key = probeKeyOf(pProbeElements[i]);
+				SIZE_T nSlot = static_cast<SIZE_T>(CHashPartitioning::MixHash(hash(key))) & (nTableSize - 1);
+
+				for (SIZE_T nEntry = pTable[nSlot]; nEntry != 0; nEntry = pChain[nEntry - 1])
+					if (buildKeyOf(pBuildElements[nEntry - 1]) == key)
+						match(nPartition, pBuildElements[nEntry - 1], pProbeElements[i]);
+			}
+		}
+	}, 1);
+}
+
+/// <summary>
+/// Implements the count and scatter passes of stable parallel filter and partition algorithms.
+/// </summary>
+/// <remarks>
+/// The input is split into blocks of a multiple of 64 indices. The count pass evaluates the predicate once per index, records the result in a bit set and counts
+/// the selected indices of each block. An exclusive prefix sum over the counts yields a disjoint output range for each block, into which the scatter pass
+/// writes the elements without any synchronization. Blocks never share a word of the bit set.
+/// </remarks>
+class CParallelSelection
+{
+private:
+	CScopedTaskScheduler& m_scheduler;
+	SIZE_T m_nCount;
+	SIZE_T m_nBlocks;
+	SIZE_T m_nSelected;
+	std::vector<ULONGLONG> m_flags;
+	std::vector<SIZE_T> m_offsets;
+
+public:
+	CParallelSelection(CScopedTaskScheduler& scheduler, SIZE_T nCount) :
+		m_scheduler(scheduler), m_nCount(nCount), m_nSelected(0), m_flags((nCount + 63) / 64, 0)
+	{
+		SIZE_T nWorkers = static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1));
+
+		m_nBlocks = (std::max)((std::min)(nWorkers * 4, nCount / 4096), static_cast<SIZE_T>(1));
+		m_offsets.assign(m_nBlocks + 1, 0);
+	}
+
+private:
+	CParallelSelection(const CParallelSelection& selection) = delete;
+
+	/// <summary>
+	/// Returns the first index of a block.
+	/// </summary>
+	SIZE_T GetBlockStart(SIZE_T nBlock) const throw()
+	{
+		return nBlock == m_nBlocks ? m_nCount : (m_nCount * nBlock / m_nBlocks) & ~static_cast<SIZE_T>(63);
+	}
+
+public:
+	/// <summary>
+	/// Returns the number of selected indices.
+	/// </summary>
+	SIZE_T GetSelectedCount() const throw()
+	{
+		return m_nSelected;
+	}
+
+	/// <summary>
+	/// Evaluates `isSelected(i)` for all indices in parallel and returns the number of selected indices.
+	/// </summary>
+	template <class TPredicate>
+	SIZE_T Select(const TPredicate& isSelected)
+	{
+		ParallelFor(m_scheduler, 0, m_nBlocks, [&](SIZE_T nFirstBlock, SIZE_T nLastBlock) {
+			for (SIZE_T nBlock = nFirstBlock; nBlock < nLastBlock; nBlock++)
+			{
+				SIZE_T nSelected = 0;
+
+				for (SIZE_T i = this->GetBlockStart(nBlock), nLast = this->GetBlockStart(nBlock + 1); i < nLast; i++)
+				{
+					if (isSelected(i))
+					{
+						m_flags[i / 64] |= 1ULL << (i % 64);
+						nSelected++;
+					}
+				}
+
+				m_offsets[nBlock] = nSelected;
+			}
+		}, 1);
+
+		// Turn the counts into the output positions of the first selected index of each block.
+		SIZE_T nOffset = 0;
+
+		for (SIZE_T nBlock = 0; nBlock <= m_nBlocks; nBlock++)
+		{
+			SIZE_T nSelected = m_offsets[nBlock];
+			m_offsets[nBlock] = nOffset;
+			nOffset += nSelected;
+		}
+
+		m_nSelected = nOffset;
+
+		return m_nSelected;
+	}
+
+	/// <summary>
+	/// Calls `scatter(i, nPosition)` in parallel for each selected index, where `nPosition` is the rank of `i` among the selected indices.
+	/// </summary>
+	template <class TScatter>
+	void ScatterSelected(const TScatter& scatter)
+	{
+		ParallelFor(m_scheduler, 0, m_nBlocks, [&](SIZE_T nFirstBlock, SIZE_T nLastBlock) {
+			for (SIZE_T nBlock = nFirstBlock; nBlock < nLastBlock; nBlock++)
+			{
+				SIZE_T nPosition = m_offsets[nBlock];
+
+				for (SIZE_T i = this->GetBlockStart(nBlock), nLast = this->GetBlockStart(nBlock + 1); i < nLast; i++)
+				{
+					ULONGLONG ullFlags = m_flags[i / 64];
+
+					// Skip words without any selected indices at once.
+					if (ullFlags == 0)
+					{
+						i |= 63;
+						continue;
+					}
+
+					if (ullFlags & (1ULL << (i % 64)))
+						scatter(i, nPosition++);
+				}
+			}
+		}, 1);
+	}
+
+	/// <summary>
+	/// Calls `scatter(i, bSelected, nPosition)` in parallel for each index, where `nPosition` is the rank of `i` among the selected or rejected indices.
+	/// </summary>
+	template <class TScatter>
+	void Scatter(const TScatter& scatter)
+	{
+		ParallelFor(m_scheduler, 0, m_nBlocks, [&](SIZE_T nFirstBlock, SIZE_T nLastBlock) {
+			for (SIZE_T nBlock = nFirstBlock; nBlock < nLastBlock; nBlock++)
+			{
+				SIZE_T nFirst = this->GetBlockStart(nBlock);
+				SIZE_T nSelectedPosition = m_offsets[nBlock];
+				SIZE_T nRejectedPosition = nFirst - nSelectedPosition;
+
+				for (SIZE_T i = nFirst, nLast = this->GetBlockStart(nBlock + 1); i < nLast; i++)
+				{
+					if (m_flags[i / 64] & (1ULL << (i % 64)))
+						scatter(i, TRUE, nSelectedPosition++);
+					else
+						scatter(i, FALSE, nRejectedPosition++);
+				}
+			}
+		}, 1);
+	}
+};
+
+/// <summary>
+/// Copies the elements of `pInput`, for which `predicate(element)` returns `true`, to `pOutput` in parallel and returns the number of copied elements.
+/// </summary>
+/// <remarks>
+/// The order of the copied elements is preserved. The predicate is evaluated once per element. `pOutput` must provide room for `nCount` elements and must not
+/// overlap the input.
+/// </remarks>
+template <class T, class TPredicate>
+SIZE_T ParallelCopyIf(CScopedTaskScheduler& scheduler, const T* pInput, SIZE_T nCount, T* pOutput, const TPredicate& predicate)
+{
+	CParallelSelection selection(scheduler, nCount);
+
+	if (selection.Select([&](SIZE_T i) { return predicate(pInput[i]); }) != 0)
+		selection.ScatterSelected([&](SIZE_T i, SIZE_T nPosition) { pOutput[nPosition] = pInput[i]; });
+
+	return selection.GetSelectedCount();
+}
+
+/// <summary>
+/// Reorders `nCount` elements in parallel, so that the elements, for which `predicate(element)` returns `true`, precede all other elements, and returns the
+/// number of these elements.
+/// </summary>
+/// <remarks>
+/// The partition is stable, like `std::stable_partition`. The elements are moved into a temporary buffer and back, so `T` must be default-constructible.
+/// </remarks>
+template <class T, class TPredicate>
+SIZE_T ParallelPartition(CScopedTaskScheduler& scheduler, T* pData, SIZE_T nCount, const TPredicate& predicate)
+{
+	CParallelSelection selection(scheduler, nCount);
+	SIZE_T nSelected = selection.Select([&](SIZE_T i) { return predicate(pData[i]); });
+
+	// Elements, that are already in place, do not need to be moved.
+	if (nSelected == 0 || nSelected == nCount)
+		return nSelected;
+
+	std::vector<T> buffer(nCount);
+
+	selection.Scatter([&](SIZE_T i, BOOL bSelected, SIZE_T nPosition) {
+		buffer[bSelected ? nPosition : nSelected + nPosition] = std::move(pData[i]);
+	});
+
+	ParallelFor(scheduler, 0, nCount, [&](SIZE_T nFirst, SIZE_T nLast) {
+		std::move(buffer.begin() + nFirst, buffer.begin() + nLast, pData + nFirst);
+	});
+
+	return nSelected;
+}
+
+/// <summary>
+/// Removes the elements, for which `predicate(element)` returns `true`, in parallel and returns the number of remaining elements.
+/// </summary>
+/// <remarks>
+/// Like `std::remove_if`, the remaining elements are moved to the front in their original order, and the elements behind them are left in a valid, but
+/// unspecified state. The removed elements are moved there by a stable <see cref="ParallelPartition">`ParallelPartition`</see>.
+/// </remarks>
+template <class T, class TPredicate>
+SIZE_T ParallelRemoveIf(CScopedTaskScheduler& scheduler, T* pData, SIZE_T nCount, const TPredicate& predicate)
+{
+	return ParallelPartition(scheduler, pData, nCount, [&](const T& element) { return !predicate(element); });
+}
+
+/// <summary>
+/// Copies the `nTop` smallest elements of `pInput` with respect to `compare` to `pOutput` in sorted order and returns the number of copied elements.
+/// </summary>
+/// <remarks>
+/// The input is split into several blocks per worker. Each block keeps its best `nTop` elements in a bounded heap, so that an element is only compared with the
+/// worst element of the heap, once the heap is full. The heaps are merged by the calling thread, which sorts the best `nTop` candidates. Use `std::greater` as
+/// `TCompare` in order to retrieve the largest elements. `pOutput` must provide room for `nTop` elements.
+/// </remarks>
+template <class T, class TCompare>
+SIZE_T ParallelTopK(CScopedTaskScheduler& scheduler, const T* pInput, SIZE_T nCount, SIZE_T nTop, T* pOutput, const TCompare& compare)
+{
+	nTop = (std::min)(nTop, nCount);
+
+	if (nTop == 0)
+		return 0;
+
+	SIZE_T nWorkers = static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1));
+	SIZE_T nBlocks = (std::max)((std::min)(nWorkers * 4, nCount / (std::max)(nTop * 4, static_cast<SIZE_T>(4096))), static_cast<SIZE_T>(1));
+	std::vector<std::vector<T>> heaps(nBlocks);
+
+	ParallelFor(scheduler, 0, nBlocks, [&](SIZE_T nFirstBlock, SIZE_T nLastBlock) {
+		for (SIZE_T nBlock = nFirstBlock; nBlock < nLastBlock; nBlock++)
+		{
+			// The heap is ordered by `compare`, so that its front is the worst of the best elements found so far.
+			std::vector<T>& heap = heaps[nBlock];
+			heap.reserve(nTop);
+
+			for (SIZE_T i = nCount * nBlock / nBlocks, nLast = nCount * (nBlock + 1) / nBlocks; i < nLast; i++)
+			{
+				if (heap.size() < nTop)
+				{
+					heap.push_back(pInput[i]);
+					std::push_heap(heap.begin(), heap.end(), compare);
+				}
+				else if (compare(pInput[i], heap.front()))
+				{
+					std::pop_heap(heap.begin(), heap.end(), compare);
+					heap.back() = pInput[i];
+					std::push_heap(heap.begin(), heap.end(), compare);
+				}
+			}
+		}
+	}, 1);
+
+	std::vector<T> candidates(std::move(heaps[0]));
+
+	for (SIZE_T nBlock = 1; nBlock < nBlocks; nBlock++)
+		candidates.insert(candidates.end(), heaps[nBlock].begin(), heaps[nBlock].end());
+
+	std::partial_sort(candidates.begin(), candidates.begin() + nTop, candidates.end(), compare);
+	std::copy(candidates.begin(), candidates.begin() + nTop, pOutput);
+
+	return nTop;
+}
+
+/// <summary>
+/// Reorders `nCount` elements in parallel like `std::nth_element`, so that the element at `nNth` is the one, that would be there in sorted order, no element
+/// before it is greater and no element after it is less with respect to `compare`.
+/// </summary>
+/// <remarks>
+/// Each round sorts a small sample of the remaining range and picks two pivots from the sample, that enclose the rank `nNth` with high probability. Two
+/// passes of <see cref="ParallelPartition">`ParallelPartition`</see> split the range into the elements less than the lower pivot, the elements between the
+/// pivots and the elements greater than the upper pivot. Rounds continue with the part, that contains `nNth`, until it is small enough for `std::nth_element`
+/// on the calling thread, or until a round does not shrink it anymore. `T` must be default-constructible.
+/// </remarks>
+template <class T, class TCompare>
+void ParallelNthElement(CScopedTaskScheduler& scheduler, T* pData, SIZE_T nCount, SIZE_T nNth, const TCompare& compare)
+{
+	static const SIZE_T SerialThreshold = 32768;
+	static const SIZE_T SampleSize = 1024;
+	static const SIZE_T PivotDistance = 32;
+
+	if (nNth >= nCount)
+		return;
+
+	SIZE_T nFirst = 0;
+	SIZE_T nLast = nCount;
+	std::vector<T> sample(SampleSize);
+
+	while (nLast - nFirst > SerialThreshold)
+	{
+		SIZE_T nSize = nLast - nFirst;
+
+		for (SIZE_T i = 0; i < SampleSize; i++)
+			sample[i] = pData[nFirst + nSize / SampleSize * i];
+
+		std::sort(sample.begin(), sample.end(), compare);
+
+		SIZE_T nRank = (nNth - nFirst) * SampleSize / nSize;
+		const T& lower = sample[nRank > PivotDistance ? nRank - PivotDistance : 0];
+		const T& upper = sample[(std::min)(nRank + PivotDistance, SampleSize - 1)];
+
+		SIZE_T nLess = ParallelPartition(scheduler, pData + nFirst, nSize, [&](const T& element) { return compare(element, lower); });
+
+		if (nNth < nFirst + nLess)
+		{
+			nLast = nFirst + nLess;
+			continue;
+		}
+
+		nFirst += nLess;
+
+		SIZE_T nBetween = ParallelPartition(scheduler, pData + nFirst, nLast - nFirst, [&](const T& element) { return !compare(upper, element); });
+
+		if (nNth >= nFirst + nBetween)
+		{
+			nFirst += nBetween;
+			continue;
+		}
+
+		nLast = nFirst + nBetween;
+
+		// All elements between equivalent pivots are equivalent themselves.
+		if (!compare(lower, upper))
+			return;
+
+		// A round, that keeps every element between the pivots, would be repeated with the same sample, so the range is selected on the calling thread.
+		if (nBetween == nSize)
+			break;
+	}
+
+	std::nth_element(pData + nFirst, pData + nNth, pData + nLast, compare);
+}
+
+/// <summary>
+/// Reorders `nCount` elements in parallel like `std::partial_sort`, so that the first `nTop` elements are the smallest ones with respect to `compare` in
+/// sorted order.
+/// </summary>
+/// <remarks>
+/// The smallest elements are moved to the front by <see cref="ParallelNthElement">`ParallelNthElement`</see>, and then sorted by the calling thread. Use
+/// <see cref="ParallelTopK">`ParallelTopK`</see> instead, if the input must not be modified, or if `nTop` is small compared to `nCount`.
+/// </remarks>
+template <class T, class TCompare>
+void ParallelPartialSort(CScopedTaskScheduler& scheduler, T* pData, SIZE_T nCount, SIZE_T nTop, const TCompare& compare)
+{
+	nTop = (std::min)(nTop, nCount);
+
+	if (nTop == 0)
+		return;
+
+	if (nTop < nCount)
+		ParallelNthElement(scheduler, pData, nCount, nTop - 1, compare);
+
+	std::sort(pData, pData + nTop, compare);
+}
+
+/// <summary>
+/// Traverses a graph in CSR format breadth-first in parallel, starting at `nSource`, and stores the level of each vertex in `pLevels`. Returns the number of
+/// reached vertices.
+/// </summary>
+/// <remarks>
+/// The edges of vertex `v` are `pTargets[pOffsets[v]]` to `pTargets[pOffsets[v + 1] - 1]`. Unreached vertices receive the level `UINT_MAX`.
+///
+/// The traversal is level-synchronous. Each level is processed in blocks, that append the vertices of the next frontier to a buffer per worker, addressed by
+/// <see cref="CScopedTaskScheduler::GetCurrentWorkerIndex">`GetCurrentWorkerIndex`</see>. The buffers are merged into the next frontier by a prefix sum over
+/// their sizes. Only the last buffer, which is shared by the calling thread and workers started during the traversal, is locked. Visited vertices are marked
+/// in a bit set with an atomic fetch-or, which also decides, which block claims a vertex. If the reverse graph is provided (which is the graph itself for undirected graphs), the traversal is
+/// direction-optimizing: while the frontier has many outgoing edges compared to the unexplored part of the graph, it switches from pushing the frontier along
+/// its outgoing edges to pulling unvisited vertices, that have an incoming edge from the frontier, which ends the scan of a vertex at its first such edge.
+/// </remarks>
+///
+/// <seealso cref="https://doi.org/10.1109/SC.2012.50">Direction-Optimizing Breadth-First Search</seealso>
+template <class TOffset, class TVertex>
+SIZE_T ParallelBreadthFirstSearch(CScopedTaskScheduler& scheduler, SIZE_T nVertices, const TOffset* pOffsets, const TVertex* pTargets, const TOffset* pReverseOffsets,
+	const TVertex* pReverseTargets, SIZE_T nSource, UINT* pLevels)
+{
+	// Thresholds for switching between pushing and pulling, as suggested by Beamer et al.
+	static const SIZE_T PushToPullRatio = 14;
+	static const SIZE_T PullToPushRatio = 24;
+
+	if (nSource >= nVertices)
+		return 0;
+
+	SIZE_T nWords = (nVertices + 63) / 64;
+	SIZE_T nWorkers = static_cast<SIZE_T>((std::max)(scheduler.GetConcurrency(), 1));
+	SIZE_T nMaxBlocks = nWorkers * 4;
+
+	std::unique_ptr<volatile LONG64[]> visited(new volatile LONG64[nWords]());
+	std::unique_ptr<volatile LONG64[]> frontierFlags;
+	std::vector<std::vector<TVertex>> buffers;
+	std::vector<SIZE_T> offsets;
+	std::vector<double> edges;
+	SRWLOCK sharedBufferLock;
+
+	::InitializeSRWLock(&sharedBufferLock);
+
+	ParallelFor(scheduler, 0, nVertices, [&](SIZE_T nFirst, SIZE_T nLast) {
+		std::fill(pLevels + nFirst, pLevels + nLast, UINT_MAX);
+	});
+
+	std::vector<TVertex> frontier(1, static_cast<TVertex>(nSource));
+	std::vector<TVertex> next;
+
+	visited[nSource / 64] = 1LL << (nSource % 64);
+	pLevels[nSource] = 0;
+
+	double dFrontierEdges = static_cast<double>(pOffsets[nSource + 1] - pOffsets[nSource]);
+	double dUnexploredEdges = static_cast<double>(pOffsets[nVertices] - pOffsets[0]) - dFrontierEdges;
+	SIZE_T nReached = 1;
+	BOOL bPull = FALSE;
+
+	for (UINT nLevel = 1; !frontier.empty(); nLevel++)
+	{
+		if (pReverseOffsets != nullptr)
+			bPull = bPull ? frontier.size() * PullToPushRatio >= nVertices : dFrontierEdges * PushToPullRatio > dUnexploredEdges;
+
+		// Worker indices only grow, while workers are started, so the buffers of previous levels are kept.
+		SIZE_T nBuffers = static_cast<SIZE_T>((std::max)(scheduler.GetWorkerIndexLimit(), 0)) + 1;
+		SIZE_T nSharedBuffer = nBuffers - 1;
+
+		buffers.resize(nBuffers);
+		offsets.resize(nBuffers + 1);
+		edges.resize(nBuffers);
+
+		for (SIZE_T nBuffer = 0; nBuffer < nBuffers; nBuffer++)
+			buffers[nBuffer].clear();
+
+		// Returns the buffer of the calling worker, and locks the shared buffer, if the calling thread has no buffer of its own.
+		auto acquireBuffer = [&]() -> SIZE_T {
+			int nWorkerIndex = scheduler.GetCurrentWorkerIndex();
+
+			if (nWorkerIndex >= 0 && static_cast<SIZE_T>(nWorkerIndex) < nSharedBuffer)
+				return static_cast<SIZE_T>(nWorkerIndex);
+
+			::AcquireSRWLockExclusive(&sharedBufferLock);
+
+			return nSharedBuffer;
+		};
+
+		auto releaseBuffer = [&](SIZE_T nBuffer) {
+			if (nBuffer == nSharedBuffer)
+				::ReleaseSRWLockExclusive(&sharedBufferLock);
+		};
+
+		SIZE_T nBlocks;
+
+		if (bPull)
+		{
+			if (!frontierFlags)
+				frontierFlags.reset(new volatile LONG64[nWords]());
+			else
+				ParallelFor(scheduler, 0, nWords, [&](SIZE_T nFirst, SIZE_T nLast) {
+					for (SIZE_T i = nFirst; i < nLast; i++)
+						frontierFlags[i] = 0;
+				});
+
+			ParallelFor(scheduler, 0, frontier.size(), [&](SIZE_T nFirst, SIZE_T nLast) {
+				for (SIZE_T i = nFirst; i < nLast; i++)
+					::InterlockedOr64(&frontierFlags[static_cast<SIZE_T>(frontier[i]) / 64], 1LL << (static_cast<SIZE_T>(frontier[i]) % 64));
+			});
+
+			// Each block owns whole words of the bit sets, so that it can scan its unvisited vertices word by word.
+			nBlocks = (std::max)((std::min)(nMaxBlocks, nWords / 16), static_cast<SIZE_T>(1));
+
+			ParallelFor(scheduler, 0, nBlocks, [&](SIZE_T nFirstBlock, SIZE_T nLastBlock) {
+				SIZE_T nBuffer = acquireBuffer();
+				std::vector<TVertex>& buffer = buffers[nBuffer];
+
+				for (SIZE_T nBlock = nFirstBlock; nBlock < nLastBlock; nBlock++)
+				{
+					for (SIZE_T nWord = nWords * nBlock / nBlocks, nLastWord = nWords * (nBlock + 1) / nBlocks; nWord < nLastWord; nWord++)
+					{
+						if (visited[nWord] == -1LL)
+							continue;
+
+						for (SIZE_T v = nWord * 64, nLast = (std::min)(v + 64, nVertices); v < nLast; v++)
+						{
+							if (visited[nWord] & (1LL << (v % 64)))
+								continue;
+
+							for (TOffset e = pReverseOffsets[v]; e < pReverseOffsets[v + 1]; e++)
+							{
+								SIZE_T u = static_cast<SIZE_T>(pReverseTargets[e]);
+
+								if (frontierFlags[u / 64] & (1LL << (u % 64)))
+								{
+									::InterlockedOr64(&visited[nWord], 1LL << (v % 64));
+									pLevels[v] = nLevel;
+									buffer.push_back(static_cast<TVertex>(v));
+									break;
+								}
+							}
+						}
+					}
+				}
+
+				releaseBuffer(nBuffer);
+			}, 1);
+		}
+		else
+		{
+			nBlocks = (std::max)((std::min)(nMaxBlocks, frontier.size() / 256), static_cast<SIZE_T>(1));
+
+			ParallelFor(scheduler, 0, nBlocks, [&](SIZE_T nFirstBlock, SIZE_T nLastBlock) {
+				SIZE_T nBuffer = acquireBuffer();
+				std::vector<TVertex>& buffer = buffers[nBuffer];
+
+				for (SIZE_T nBlock = nFirstBlock; nBlock < nLastBlock; nBlock++)
+				{
+					for (SIZE_T i = frontier.size() * nBlock / nBlocks, nLast = frontier.size() * (nBlock + 1) / nBlocks; i < nLast; i++)
+					{
+						SIZE_T u = static_cast<SIZE_T>(frontier[i]);
+
+						for (TOffset e = pOffsets[u]; e < pOffsets[u + 1]; e++)
+						{
+							SIZE_T v = static_cast<SIZE_T>(pTargets[e]);
+							LONG64 llFlag = 1LL << (v % 64);
+
+							// Only the block, that sets the flag, adds the vertex to the next frontier.
+							if ((visited[v / 64] & llFlag) == 0 && (::InterlockedOr64(&visited[v / 64], llFlag) & llFlag) == 0)
+							{
+								pLevels[v] = nLevel;
+								buffer.push_back(static_cast<TVertex>(v));
+							}
+						}
+					}
+				}
+
+				releaseBuffer(nBuffer);
+			}, 1);
+		}
+
+		// Merge the buffers into the next frontier and count its outgoing edges.
+		offsets[0] = 0;
+
+		for (SIZE_T nBuffer = 0; nBuffer < nBuffers; nBuffer++)
+			offsets[nBuffer + 1] = offsets[nBuffer] + buffers[nBuffer].size();
+
+		next.resize(offsets[nBuffers]);
+
+		ParallelFor(scheduler, 0, nBuffers, [&](SIZE_T nFirstBuffer, SIZE_T nLastBuffer) {
+			for (SIZE_T nBuffer = nFirstBuffer; nBuffer < nLastBuffer; nBuffer++)
+			{
+				double dEdges = 0.0;
+
+				for (SIZE_T i = 0; i < buffers[nBuffer].size(); i++)
+				{
+					SIZE_T v = static_cast<SIZE_T>(buffers[nBuffer][i]);
+					next[offsets[nBuffer] + i] = buffers[nBuffer][i];
+					dEdges += static_cast<double>(pOffsets[v + 1] - pOffsets[v]);
+				}
+
+				edges[nBuffer] = dEdges;
+			}
+		}, 1);
+
+		dFrontierEdges = 0.0;
+
+		for (SIZE_T nBuffer = 0; nBuffer < nBuffers; nBuffer++)
+			dFrontierEdges += edges[nBuffer];
+
+		dUnexploredEdges -= dFrontierEdges;
+		nReached += next.size();
+		frontier.swap(next);
+	}
+
+	return nReached;
+}
+
+/// <summary>
+/// A concurrent hash map, that serves lookups without any locks, and reclaims removed entries through a <see cref="CEpochDomain">`CEpochDomain`</see>.
+/// </summary>
+/// <remarks>
+/// The map is split into shards, each with its own lock and bucket array. Writers lock a single shard and never modify an entry, that is visible to readers:
+/// updates replace the entry, and replaced or removed entries as well as outgrown bucket arrays are retired after the shard lock has been released. Readers
+/// traverse the bucket chains without locking and copy values out of the entries, which is safe as long as they are online participants of the epoch domain.
+/// This holds for all requests executed by the workers of a `CThreadPoolEx`, if the map uses the pool's epoch domain.
+/// </remarks>
+template <class TKey, class TValue, class THash = std::hash<TKey>, class TKeyEqual = std::equal_to<TKey>>
+class CConcurrentHashMap
+{
+private:
+	struct CNode
+	{
+		TKey m_key;
+		TValue m_value;
+		CNode* volatile m_pNext;
+
+		CNode(const TKey& key, const TValue& value, CNode* pNext) :
+			m_key(key), m_value(value), m_pNext(pNext)
+		{
+		}
+	};
+
+	struct CBucketArray
+	{
+		SIZE_T m_nMask;
+		std::unique_ptr<CNode* volatile[]> m_buckets;
+
+		explicit CBucketArray(SIZE_T nBuckets) :
+			m_nMask(nBuckets - 1), m_buckets(new CNode* volatile[nBuckets]())
+		{
+		}
+
+		/// <summary>
+		/// Deletes the array together with all entries, that are linked into it.
+		/// </summary>
+		static void Destroy(CBucketArray* pBuckets) throw()
+		{
+			for (SIZE_T nBucket = 0; nBucket <= pBuckets->m_nMask; nBucket++)
+			{
+				for (CNode* pNode = pBuckets->m_buckets[nBucket]; pNode != nullptr;)
+				{
+					CNode* pNext = pNode->m_pNext;
+					delete pNode;
+					pNode = pNext;
+				}
+			}
+
+			delete pBuckets;
+		}
+	};
+
+	/// <summary>
+	/// The objects, that a writer has unlinked from a locked shard. They are retired after the lock has been released, since retiring may run deleters.
+	/// </summary>
+	struct CRetired
+	{
+		CNode* m_pNode;
+		CBucketArray* m_pBuckets;
+
+		CRetired() throw() :
+			m_pNode(nullptr), m_pBuckets(nullptr)
+		{
+		}
+	};
+
+	struct CShard
+	{
+		SRWLOCK m_lock;
+		CBucketArray* volatile m_pBuckets;
+		SIZE_T m_nSize;
+
+		// Prevent false sharing of the locks of adjacent shards.
+		BYTE m_padding[SYSTEM_CACHE_ALIGNMENT_SIZE];
+
+		CShard() :
+			m_pBuckets(nullptr), m_nSize(0)
+		{
+			::InitializeSRWLock(&m_lock);
+		}
+	};
+
+private:
+	CEpochDomain& m_domain;
+	std::unique_ptr<CShard[]> m_shards;
+	UINT m_nShardBits;
+	volatile LONG m_lSize;
+	THash m_hash;
+	TKeyEqual m_keyEqual;
+
+public:
+	/// <summary>
+	/// Initializes a map with `1 << nShardBits` shards, whose entries are reclaimed through `domain`.
+	/// </summary>
+	explicit CConcurrentHashMap(CEpochDomain& domain, UINT nShardBits = 6, const THash& hash = THash(), const TKeyEqual& keyEqual = TKeyEqual()) :
+		m_domain(domain), m_shards(new CShard[static_cast<SIZE_T>(1) << nShardBits]), m_nShardBits(nShardBits), m_lSize(0), m_hash(hash), m_keyEqual(keyEqual)
+	{
+		for (SIZE_T nShard = 0; nShard < (static_cast<SIZE_T>(1) << m_nShardBits); nShard++)
+			m_shards[nShard].m_pBuckets = new CBucketArray(8);
+	}
+
+	/// <summary>
+	/// Deletes all entries. There must not be any concurrent readers left.
+	/// </summary>
+	~CConcurrentHashMap() throw()
+	{
+		for (SIZE_T nShard = 0; nShard < (static_cast<SIZE_T>(1) << m_nShardBits); nShard++)
+			CBucketArray::Destroy(m_shards[nShard].m_pBuckets);
+	}
+
+private:
+	CConcurrentHashMap(const CConcurrentHashMap& map) = delete;
+
+	ULONGLONG GetHash(const TKey& key) const
+	{
+		return CHashPartitioning::MixHash(static_cast<ULONGLONG>(m_hash(key)));
+	}
+
+	CShard& GetShard(ULONGLONG ullHash) const throw()
+	{
+		return m_shards[CHashPartitioning::GetPartition(ullHash, m_nShardBits)];
+	}
+
+	static void Publish(CNode* volatile& target, CNode* pNode) throw()
+	{
+		::InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&target), pNode);
+	}
+
+	void Retire(const CRetired& retired)
+	{
+		if (retired.m_pNode != nullptr)
+			m_domain.Retire(retired.m_pNode);
+
+		if (retired.m_pBuckets != nullptr)
+			m_domain.Retire(retired.m_pBuckets, &CBucketArray::Destroy);
+	}
+
+	/// <summary>
+	/// Doubles the number of buckets of a locked shard and returns the old array. The entries are copied, since readers may still traverse the chains of the old
+	/// array.
+	/// </summary>
+	CBucketArray* Grow(CShard& shard)
+	{
+		CBucketArray* pOldBuckets = shard.m_pBuckets;
+		CBucketArray* pNewBuckets = new CBucketArray((pOldBuckets->m_nMask + 1) * 2);
+
+		for (SIZE_T nBucket = 0; nBucket <= pOldBuckets->m_nMask; nBucket++)
+		{
+			for (CNode* pNode = pOldBuckets->m_buckets[nBucket]; pNode != nullptr; pNode = pNode->m_pNext)
+			{
+				CNode* volatile& head = pNewBuckets->m_buckets[static_cast<SIZE_T>(this->GetHash(pNode->m_key)) & pNewBuckets->m_nMask];
+				head = new CNode(pNode->m_key, pNode->m_value, head);
+			}
+		}
+
+		::InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&shard.m_pBuckets), pNewBuckets);
+
+		return pOldBuckets;
+	}
+
+	/// <summary>
+	/// Inserts or replaces an entry within a locked shard. Returns `FALSE`, if the key already exists and `bAssign` is `FALSE`. Replaced entries and outgrown
+	/// bucket arrays are stored in `retired`.
+	/// </summary>
+	BOOL InsertLocked(CShard& shard, ULONGLONG ullHash, const TKey& key, const TValue& value, BOOL bAssign, CRetired& retired)
+	{
+		CNode* volatile& head = shard.m_pBuckets->m_buckets[static_cast<SIZE_T>(ullHash) & shard.m_pBuckets->m_nMask];
+
+		for (CNode* volatile* ppNode = &head; *ppNode != nullptr; ppNode = &(*ppNode)->m_pNext)
+		{
+			CNode* pNode = *ppNode;
+
+			if (!m_keyEqual(pNode->m_key, key))
+				continue;
+
+			if (!bAssign)
+				return FALSE;
+
+			// Replace the entry, since readers may be copying its value.
+			Publish(*ppNode, new CNode(key, value, pNode->m_pNext));
+			retired.m_pNode = pNode;
+
+			return TRUE;
+		}
+
+		Publish(head, new CNode(key, value, head));
+		::InterlockedIncrement(&m_lSize);
+
+		if (++shard.m_nSize > shard.m_pBuckets->m_nMask + 1)
+			retired.m_pBuckets = this->Grow(shard);
+
+		return TRUE;
+	}
+
+public:
+	/// <summary>
+	/// Copies the value stored for `key` to `value`. Returns `FALSE`, if there is no such key.
+	/// </summary>
+	BOOL Find(const TKey& key, TValue& value) const
+	{
+		ULONGLONG ullHash = this->GetHash(key);
+		CBucketArray* pBuckets = this->GetShard(ullHash).m_pBuckets;
+
+		for (CNode* pNode = pBuckets->m_buckets[static_cast<SIZE_T>(ullHash) & pBuckets->m_nMask]; pNode != nullptr; pNode = pNode->m_pNext)
+		{
+			if (m_keyEqual(pNode->m_key, key))
+			{
+				value = pNode->m_value;
+				return TRUE;
+			}
+		}
+
+		return FALSE;
+	}
+
+	/// <summary>
+	/// Returns `TRUE`, if the map contains `key`.
+	/// </summary>
+	BOOL Contains(const TKey& key) const
+	{
+		ULONGLONG ullHash = this->GetHash(key);
+		CBucketArray* pBuckets = this->GetShard(ullHash).m_pBuckets;
+
+		for (CNode* pNode = pBuckets->m_buckets[static_cast<SIZE_T>(ullHash) & pBuckets->m_nMask]; pNode != nullptr; pNode = pNode->m_pNext)
+			if (m_keyEqual(pNode->m_key, key))
+				return TRUE;
+
+		return FALSE;
+	}
+
+	/// <summary>
+	/// Inserts an entry. Returns `FALSE`, if the key already exists.
+	/// </summary>
+	BOOL Insert(const TKey& key, const TValue& value)
+	{
+		ULONGLONG ullHash = this->GetHash(key);
+		CShard& shard = this->GetShard(ullHash);
+
+		CRetired retired;
+
+		::AcquireSRWLockExclusive(&shard.m_lock);
+		BOOL bInserted = this->InsertLocked(shard, ullHash, key, value, FALSE, retired);
+		::ReleaseSRWLockExclusive(&shard.m_lock);
+
+		this->Retire(retired);
+
+		return bInserted;
+	}
+
+	/// <summary>
+	/// Inserts an entry, or replaces the value of an existing one.
+	/// </summary>
+	void InsertOrAssign(const TKey& key, const TValue& value)
+	{
+		ULONGLONG ullHash = this->GetHash(key);
+		CShard& shard = this->GetShard(ullHash);
+
+		CRetired retired;
+
+		::AcquireSRWLockExclusive(&shard.m_lock);
+		this->InsertLocked(shard, ullHash, key, value, TRUE, retired);
+		::ReleaseSRWLockExclusive(&shard.m_lock);
+
+		this->Retire(retired);
+	}
+
+	/// <summary>
+	/// Removes an entry. Returns `FALSE`, if there is no such key.
+	/// </summary>
+	BOOL Erase(const TKey& key)
+	{
+		ULONGLONG ullHash = this->GetHash(key);
+		CShard& shard = this->GetShard(ullHash);
+		CRetired retired;
+
+		::AcquireSRWLockExclusive(&shard.m_lock);
+
+		for (CNode* volatile* ppNode = &shard.m_pBuckets->m_buckets[static_cast<SIZE_T>(ullHash) & shard.m_pBuckets->m_nMask]; *ppNode != nullptr; ppNode = &(*ppNode)->m_pNext)
+		{
+			CNode* pNode = *ppNode;
+
+			if (m_keyEqual(pNode->m_key, key))
+			{
+				// Readers, that currently visit the entry, can still follow its link to the next one.
+				Publish(*ppNode, pNode->m_pNext);
+				retired.m_pNode = pNode;
+
+				shard.m_nSize--;
+				break;
+			}
+		}
+
+		::ReleaseSRWLockExclusive(&shard.m_lock);
+
+		if (retired.m_pNode == nullptr)
+			return FALSE;
+
+		::InterlockedDecrement(&m_lSize);
+		this->Retire(retired);
+
+		return TRUE;
+	}
+
+	/// <summary>
+	/// Returns the number of entries.
+	/// </summary>
+	SIZE_T GetSize() const throw()
+	{
+		return static_cast<SIZE_T>(m_lSize);
+	}
+};
+
+/// <summary>
+/// The completion key, that marks completion packets of <see cref="CIoOperation">`CIoOperation`</see> instances.
+/// </summary>
+#define ATLS_POOLEX_IO_COMPLETION ((ULONG_PTR) -3)
+
+/// <summary>
+/// An asynchronous operation, whose completion is dispatched to a worker of a `CThreadPoolEx`.
+/// </summary>
+/// <remarks>
+/// Handles, that are associated with a pool by `CThreadPoolEx::AssociateHandle`, report completed I/O with the key `ATLS_POOLEX_IO_COMPLETION`. Workers pass the
+/// `OVERLAPPED` structure of such packets back to the operation, instead of interpreting the completion key as a request. The operation must stay alive until
+/// `OnComplete` has been called.
+/// </remarks>
+class CIoOperation :
+	public OVERLAPPED
+{
+public:
+	CIoOperation() throw()
+	{
+		::memset(static_cast<OVERLAPPED*>(this), 0, sizeof(OVERLAPPED));
+	}
+
+	virtual ~CIoOperation() throw()
+	{
+	}
+
+private:
+	CIoOperation(const CIoOperation& operation) = delete;
+
+public:
+	/// <summary>
+	/// Called by a worker, after the operation has completed, with the Win32 error code and the number of transferred bytes.
+	/// </summary>
+	virtual void OnComplete(DWORD dwError, DWORD dwBytesTransferred) throw() = 0;
+};
+
+#if defined(ATLS_POOLEX_COROUTINES)
+
+/// <summary>
+/// The result of an awaited asynchronous operation.
+/// </summary>
+struct CIoResult
+{
+	DWORD dwError;
+	DWORD dwBytesTransferred;
+};
+
+/// <summary>
+/// A coroutine return type for detached coroutines, that start on the calling thread and continue on the workers, that complete the operations they await.
+/// </summary>
+/// <remarks>
+/// The coroutine frame is destroyed when the coroutine returns. Exceptions must not leave the coroutine.
+/// </remarks>
+struct CIoTask
+{
+	struct promise_type
+	{
+		CIoTask get_return_object() throw()
+		{
+			return CIoTask();
+		}
+
+		std::suspend_never initial_suspend() throw()
+		{
+			return std::suspend_never();
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return std::suspend_never();
+		}
+
+		void return_void() throw()
+		{
+		}
+
+		void unhandled_exception() throw()
+		{
+			std::terminate();
+		}
+	};
+};
+
+/// <summary>
+/// The base class of awaitable asynchronous operations, that resume the awaiting coroutine on the worker, that receives the completion packet.
+/// </summary>
+/// <remarks>
+/// Derived classes store the coroutine in `m_continuation` and start the operation in `await_suspend`. Once the operation has been started, the coroutine may
+/// be resumed on a worker before `await_suspend` returns, so the awaitable must not be accessed afterwards.
+/// </remarks>
+class CIoAwaitable :
+	public CIoOperation
+{
+protected:
+	std::coroutine_handle<> m_continuation;
+	DWORD m_dwError;
+	DWORD m_dwBytesTransferred;
+
+public:
+	CIoAwaitable() throw() :
+		m_dwError(ERROR_SUCCESS), m_dwBytesTransferred(0)
+	{
+	}
+
+public:
+	virtual void OnComplete(DWORD dwError, DWORD dwBytesTransferred) throw() override
+	{
+		m_dwError = dwError;
+		m_dwBytesTransferred = dwBytesTransferred;
+
+		m_continuation.resume();
+	}
+
+	bool await_ready() const throw()
+	{
+		return false;
+	}
+
+	CIoResult await_resume() throw()
+	{
+		CIoResult result = { m_dwError, m_dwBytesTransferred };
+
+		return result;
+	}
+
+protected:
+	/// <summary>
+	/// Returns `true`, if an operation has been started and a completion packet will be queued. Otherwise stores the error, so that the coroutine continues
+	/// without being suspended.
+	/// </summary>
+	bool IsPending(BOOL bResult) throw()
+	{
+		if (!bResult)
+		{
+			DWORD dwError = ::GetLastError();
+
+			if (dwError != ERROR_IO_PENDING)
+			{
+				m_dwError = dwError;
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+/// <summary>
+/// Reads from a file or device, that has been associated with a pool, at the provided offset.
+/// </summary>
+class CReadAwaitable :
+	public CIoAwaitable
+{
+private:
+	HANDLE m_hFile;
+	LPVOID m_pBuffer;
+	DWORD m_dwSize;
+
+public:
+	CReadAwaitable(HANDLE hFile, LPVOID pBuffer, DWORD dwSize, ULONGLONG ullOffset) throw() :
+		m_hFile(hFile), m_pBuffer(pBuffer), m_dwSize(dwSize)
+	{
+		this->Offset = static_cast<DWORD>(ullOffset);
+		this->OffsetHigh = static_cast<DWORD>(ullOffset >> 32);
+	}
+
+public:
+	bool await_suspend(std::coroutine_handle<> continuation) throw()
+	{
+		m_continuation = continuation;
+
+		return this->IsPending(::ReadFile(m_hFile, m_pBuffer, m_dwSize, nullptr, this));
+	}
+};
+
+/// <summary>
+/// Writes to a file or device, that has been associated with a pool, at the provided offset.
+/// </summary>
+class CWriteAwaitable :
+	public CIoAwaitable
+{
+private:
+	HANDLE m_hFile;
+	LPCVOID m_pBuffer;
+	DWORD m_dwSize;
+
+public:
+	CWriteAwaitable(HANDLE hFile, LPCVOID pBuffer, DWORD dwSize, ULONGLONG ullOffset) throw() :
+		m_hFile(hFile), m_pBuffer(pBuffer), m_dwSize(dwSize)
+	{
+		this->Offset = static_cast<DWORD>(ullOffset);
+		this->OffsetHigh = static_cast<DWORD>(ullOffset >> 32);
+	}
+
+public:
+	bool await_suspend(std::coroutine_handle<> continuation) throw()
+	{
+		m_continuation = continuation;
+
+		return this->IsPending(::WriteFile(m_hFile, m_pBuffer, m_dwSize, nullptr, this));
+	}
+};
+
+#if defined(_MSWSOCK_)
+/// <summary>
+/// Accepts a connection on a listening socket, that has been associated with a pool, using an unbound socket provided by the caller.
+/// </summary>
+/// <remarks>
+/// Only available, if `mswsock.h` has been included before this header. The accepted socket inherits the properties of the listening socket.
+/// </remarks>
+class CAcceptAwaitable :
+	public CIoAwaitable
+{
+private:
+	SOCKET m_listenSocket;
+	SOCKET m_acceptSocket;
+	BYTE m_addresses[2 * (sizeof(SOCKADDR_STORAGE) + 16)];
+
+public:
+	CAcceptAwaitable(SOCKET listenSocket, SOCKET acceptSocket) throw() :
+		m_listenSocket(listenSocket), m_acceptSocket(acceptSocket)
+	{
+	}
+
+public:
+	bool await_suspend(std::coroutine_handle<> continuation) throw()
+	{
+		m_continuation = continuation;
+
+		DWORD dwBytesReceived;
+
+		if (::AcceptEx(m_listenSocket, m_acceptSocket, m_addresses, 0, sizeof(SOCKADDR_STORAGE) + 16, sizeof(SOCKADDR_STORAGE) + 16, &dwBytesReceived, this))
+			return true;
+
+		DWORD dwError = ::WSAGetLastError();
+
+		if (dwError == ERROR_IO_PENDING)
+			return true;
+
+		m_dwError = dwError;
+
+		return false;
+	}
+
+	CIoResult await_resume() throw()
+	{
+		if (m_dwError == ERROR_SUCCESS)
+			::setsockopt(m_acceptSocket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, reinterpret_cast<char*>(&m_listenSocket), sizeof(m_listenSocket));
+
+		return CIoAwaitable::await_resume();
+	}
+};
+#endif
+
+/// <summary>
+/// Continues the awaiting coroutine on a worker of a pool.
+/// </summary>
+class CScheduleAwaitable :
+	public CIoAwaitable
+{
+private:
+	HANDLE m_hPort;
+
+public:
+	explicit CScheduleAwaitable(HANDLE hPort) throw() :
+		m_hPort(hPort)
+	{
+	}
+
+public:
+	bool await_suspend(std::coroutine_handle<> continuation) throw()
+	{
+		m_continuation = continuation;
+
+		if (::PostQueuedCompletionStatus(m_hPort, 0, ATLS_POOLEX_IO_COMPLETION, this))
+			return true;
+
+		m_dwError = ::GetLastError();
+
+		return false;
+	}
+};
+
+/// <summary>
+/// Continues the awaiting coroutine on a worker of a pool, after a timeout has elapsed, without blocking a thread in the meantime.
+/// </summary>
+class CSleepAwaitable :
+	public CIoAwaitable
+{
+private:
+	HANDLE m_hPort;
+	HANDLE m_hTimer;
+	DWORD m_dwMilliseconds;
+	volatile LONG m_lPending;
+
+public:
+	CSleepAwaitable(HANDLE hPort, DWORD dwMilliseconds) throw() :
+		m_hPort(hPort), m_hTimer(nullptr), m_dwMilliseconds(dwMilliseconds), m_lPending(2)
+	{
+	}
+
+private:
+	static VOID CALLBACK TimerCallback(PVOID pParameter, BOOLEAN bTimerOrWaitFired) throw()
+	{
+		static_cast<CSleepAwaitable*>(pParameter)->Release();
+	}
+
+	/// <summary>
+	/// Queues the completion packet, after the timer has elapsed and `await_suspend` has stored the timer handle, whichever comes last.
+	/// </summary>
+	void Release() throw()
+	{
+		HANDLE hPort = m_hPort;
+
+		if (::InterlockedDecrement(&m_lPending) == 0)
+			::PostQueuedCompletionStatus(hPort, 0, ATLS_POOLEX_IO_COMPLETION, this);
+	}
+
+public:
+	bool await_suspend(std::coroutine_handle<> continuation) throw()
+	{
+		m_continuation = continuation;
+
+		if (!::CreateTimerQueueTimer(&m_hTimer, nullptr, &CSleepAwaitable::TimerCallback, this, m_dwMilliseconds, 0, WT_EXECUTEONLYONCE))
+		{
+			m_dwError = ::GetLastError();
+			return false;
+		}
+
+		this->Release();
+
+		return true;
+	}
+
+	CIoResult await_resume() throw()
+	{
+		// The callback has already returned, or does not access the timer anymore.
+		if (m_hTimer != nullptr)
+			::DeleteTimerQueueTimer(nullptr, m_hTimer, nullptr);
+
+		return CIoAwaitable::await_resume();
+	}
+};
+
+#endif
+
+/// <summary>
+/// A single-consumer stream of results, that are produced concurrently and yielded in the order of their completion.
+/// </summary>
+/// <remarks>
+/// The number of results is known in advance, so each producer claims a slot in a fixed-size buffer with an atomic increment and publishes its result by
+/// setting the slot's ready flag. The consumer reads the slots in the order they have been claimed. It only blocks, if the next slot has not been published
+/// yet, in which case the producer, that publishes it, signals an event or resumes the awaiting coroutine. If the event can not be created, `Next` polls the
+/// slot instead. Producers, that can not produce a result, publish an error with `Fail`, so that the consumer still receives an entry for each input.
+/// `TResult` must be default-constructible.
+/// </remarks>
+///
+/// <seealso cref="SubmitAll">`SubmitAll`</seealso>
+template <class TResult>
+class CCompletionStream
+{
+private:
+	/// <summary>
+	/// The consumer is not waiting.
+	/// </summary>
+	static const LONG64 WaiterNone = 0;
+
+	/// <summary>
+	/// The consumer waits for the event.
+	/// </summary>
+	static const LONG64 WaiterThread = 1;
+
+	/// <summary>
+	/// The consumer is a suspended coroutine.
+	/// </summary>
+	static const LONG64 WaiterCoroutine = 2;
+
+	/// <summary>
+	/// Masks the kind of the waiter. The remaining bits hold the position of the result it waits for, so that a stale announcement can not be confused with
+	/// a later one.
+	/// </summary>
+	static const LONG64 WaiterKindMask = 3;
+
+	struct CSlot
+	{
+		TResult m_result;
+		SIZE_T m_nIndex;
+		HRESULT m_hr;
+		volatile LONG m_lReady;
+
+		CSlot() :
+			m_result(), m_nIndex(0), m_hr(S_OK), m_lReady(FALSE)
+		{
+		}
+	};
+
+private:
+	std::unique_ptr<CSlot[]> m_slots;
+	SIZE_T m_nCount;
+	SIZE_T m_nNext;
+	volatile LONG64 m_llCompleted;
+	volatile LONG64 m_llWaiter;
+	HANDLE m_hEvent;
+#if defined(ATLS_POOLEX_COROUTINES)
+	std::coroutine_handle<> m_continuation;
+#endif
+
+public:
+	/// <summary>
+	/// Initializes a stream, that yields `nCount` results.
+	/// </summary>
+	explicit CCompletionStream(SIZE_T nCount) :
+		m_slots(new CSlot[nCount]), m_nCount(nCount), m_nNext(0), m_llCompleted(0), m_llWaiter(WaiterNone)
+	{
+		m_hEvent = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	}
+
+	~CCompletionStream() throw()
+	{
+		if (m_hEvent != nullptr)
+			::CloseHandle(m_hEvent);
+	}
+
+private:
+	CCompletionStream(const CCompletionStream& stream) = delete;
+
+	BOOL IsReady(SIZE_T nPosition) const throw()
+	{
+		return m_slots[nPosition].m_lReady != FALSE;
+	}
+
+	BOOL IsNextReady() const throw()
+	{
+		return this->IsReady(m_nNext);
+	}
+
+	LONG64 GetWaiterToken(SIZE_T nPosition, LONG64 llKind) const throw()
+	{
+		return static_cast<LONG64>(nPosition << 2) | llKind;
+	}
+
+	void TakeNext(TResult& result, SIZE_T* pnIndex, HRESULT* phr)
+	{
+		CSlot& slot = m_slots[m_nNext++];
+
+		result = std::move(slot.m_result);
+
+		if (pnIndex != nullptr)
+			*pnIndex = slot.m_nIndex;
+
+		if (phr != nullptr)
+			*phr = slot.m_hr;
+	}
+
+	CSlot& ClaimSlot() throw()
+	{
+		return m_slots[static_cast<SIZE_T>(::InterlockedIncrement64(&m_llCompleted) - 1)];
+	}
+
+	void Publish(CSlot& slot, SIZE_T nIndex, HRESULT hr)
+	{
+		slot.m_nIndex = nIndex;
+		slot.m_hr = hr;
+		::InterlockedExchange(&slot.m_lReady, TRUE);
+
+		// Only signal the consumer, if it has announced, that it is waiting, and the result it waits for has been published. Otherwise the producer of
+		// that result signals it.
+		LONG64 llWaiter = m_llWaiter;
+
+		if (llWaiter == WaiterNone || !this->IsReady(static_cast<SIZE_T>(llWaiter) >> 2))
+			return;
+
+		if (::InterlockedCompareExchange64(&m_llWaiter, WaiterNone, llWaiter) != llWaiter)
+			return;
+
+		if ((llWaiter & WaiterKindMask) == WaiterThread)
+			::SetEvent(m_hEvent);
+#if defined(ATLS_POOLEX_COROUTINES)
+		else
+			m_continuation.resume();
+#endif
+	}
+
+public:
+	/// <summary>
+	/// Returns the number of results, that the stream yields in total.
+	/// </summary>
+	SIZE_T GetCount() const throw()
+	{
+		return m_nCount;
+	}
+
+	/// <summary>
+	/// Called by a producer, in order to publish the result for the input with the index `nIndex`. Must be called exactly once for each input.
+	/// </summary>
+	template <class T>
+	void Complete(SIZE_T nIndex, T&& result)
+	{
+		CSlot& slot = this->ClaimSlot();
+
+		slot.m_result = std::forward<T>(result);
+		this->Publish(slot, nIndex, S_OK);
+	}
+
+	/// <summary>
+	/// Called by a producer instead of `Complete`, if the result for the input with the index `nIndex` can not be produced. The consumer receives a
+	/// default-constructed result and `hr`.
+	/// </summary>
+	void Fail(SIZE_T nIndex, HRESULT hr)
+	{
+		this->Publish(this->ClaimSlot(), nIndex, hr);
+	}
+
+	/// <summary>
+	/// Retrieves the next completed result and, optionally, the index of its input and whether it has been produced (`S_OK`) or failed. Blocks until a result
+	/// is available. Returns `FALSE`, if all results have been retrieved.
+	/// </summary>
+	BOOL Next(TResult& result, SIZE_T* pnIndex = nullptr, HRESULT* phr = nullptr)
+	{
+		if (m_nNext == m_nCount)
+			return FALSE;
+
+		while (!this->IsNextReady())
+		{
+			// Without an event, there is nothing to wait for, so the slot is polled.
+			if (m_hEvent == nullptr)
+			{
+				::SwitchToThread();
+				continue;
+			}
+
+			LONG64 llToken = this->GetWaiterToken(m_nNext, WaiterThread);
+
+			::InterlockedExchange64(&m_llWaiter, llToken);
+
+			// The result might have been published before the waiter has been announced.
+			if (this->IsNextReady())
+			{
+				::InterlockedCompareExchange64(&m_llWaiter, WaiterNone, llToken);
+				break;
+			}
+
+			::WaitForSingleObject(m_hEvent, INFINITE);
+		}
+
+		this->TakeNext(result, pnIndex, phr);
+
+		return TRUE;
+	}
+
+#if defined(ATLS_POOLEX_COROUTINES)
+	/// <summary>
+	/// An awaitable, that retrieves the next completed result of a stream.
+	/// </summary>
+	class CNextAwaitable
+	{
+	private:
+		CCompletionStream& m_stream;
+		TResult& m_result;
+		SIZE_T* m_pnIndex;
+		HRESULT* m_phr;
+
+	public:
+		CNextAwaitable(CCompletionStream& stream, TResult& result, SIZE_T* pnIndex, HRESULT* phr) throw() :
+			m_stream(stream), m_result(result), m_pnIndex(pnIndex), m_phr(phr)
+		{
+		}
+
+	public:
+		bool await_ready() const throw()
+		{
+			return m_stream.m_nNext == m_stream.m_nCount || m_stream.IsNextReady();
+		}
+
+		bool await_suspend(std::coroutine_handle<> continuation) throw()
+		{
+			// Once the waiter has been announced, a producer may resume the coroutine, which advances the stream and destroys the awaitable, so only locals
+			// are used from there on.
+			CCompletionStream& stream = m_stream;
+			SIZE_T nPosition = stream.m_nNext;
+			LONG64 llToken = stream.GetWaiterToken(nPosition, WaiterCoroutine);
+
+			stream.m_continuation = continuation;
+			::InterlockedExchange64(&stream.m_llWaiter, llToken);
+
+			// If the result has been published in the meantime, continue immediately, unless the producer has already taken over the resumption.
+			if (stream.IsReady(nPosition))
+				return ::InterlockedCompareExchange64(&stream.m_llWaiter, WaiterNone, llToken) != llToken;
+
+			return true;
+		}
+
+		BOOL await_resume()
+		{
+			if (m_stream.m_nNext == m_stream.m_nCount)
+				return FALSE;
+
+			m_stream.TakeNext(m_result, m_pnIndex, m_phr);
+
+			return TRUE;
+		}
+	};
+
+	/// <summary>
+	/// Returns an awaitable, that retrieves the next completed result and, optionally, the index of its input and its status like `Next`, and evaluates to
+	/// `FALSE`, if all results have been retrieved. The coroutine is resumed on the thread, that publishes the result.
+	/// </summary>
+	CNextAwaitable NextAsync(TResult& result, SIZE_T* pnIndex = nullptr, HRESULT* phr = nullptr) throw()
+	{
+		return CNextAwaitable(*this, result, pnIndex, phr);
+	}
+#endif
+};
+
+/// <summary>
+/// The result, that the stream returned by <see cref="SubmitAll">`SubmitAll`</see> yields for functions, that return `void`.
+/// </summary>
+struct CVoidResult
+{
+};
+
+/// <summary>
+/// Calls the function of a request queued by <see cref="SubmitAll">`SubmitAll`</see> and publishes its result.
+/// </summary>
+template <class TResult>
+struct CSubmitAllTraits
+{
+	typedef TResult ResultType;
+
+	template <class F, class T>
+	static void Complete(CCompletionStream<ResultType>& stream, SIZE_T nIndex, F& f, const T& element)
+	{
+		stream.Complete(nIndex, f(element));
+	}
+};
+
+/// <summary>
+/// Publishes a <see cref="CVoidResult">`CVoidResult`</see> for functions, that return `void`, so that the stream still yields the index of each completed input.
+/// </summary>
+template <>
+struct CSubmitAllTraits<void>
+{
+	typedef CVoidResult ResultType;
+
+	template <class F, class T>
+	static void Complete(CCompletionStream<ResultType>& stream, SIZE_T nIndex, F& f, const T& element)
+	{
+		f(element);
+		stream.Complete(nIndex, CVoidResult());
+	}
+};
+
+/// <summary>
+/// Queues a request for each element of `range`, that calls `f(element)`, and returns a stream, that yields the results in the order in which they complete.
+/// </summary>
+/// <remarks>
+/// The elements are copied into the requests. The pool must accept <see cref="LambdaRequest">`LambdaRequest`</see> instances. The stream is shared with the
+/// requests, so it may be released before all results have been retrieved. Inputs, whose requests can not be queued, are yielded with the status `E_FAIL`
+/// (see <see cref="CCompletionStream::Fail">`Fail`</see>). If `f` returns `void`, the stream yields <see cref="CVoidResult">`CVoidResult`</see>
+/// instances, whose indices tell, which inputs have been processed.
+/// </remarks>
+template <class TPool, class TRange, class F>
+std::shared_ptr<CCompletionStream<typename CSubmitAllTraits<typename std::decay<decltype(std::declval<F&>()(*std::begin(std::declval<const TRange&>())))>::type>::ResultType>>
+	SubmitAll(TPool& pool, const TRange& range, F&& f)
+{
+	typedef CSubmitAllTraits<typename std::decay<decltype(std::declval<F&>()(*std::begin(range)))>::type> TTraits;
+	typedef typename TTraits::ResultType TResult;
+
+	auto stream = std::make_shared<CCompletionStream<TResult>>(static_cast<SIZE_T>(std::distance(std::begin(range), std::end(range))));
+	auto function = std::make_shared<typename std::decay<F>::type>(std::forward<F>(f));
+
+	SIZE_T nIndex = 0;
+
+	for (auto it = std::begin(range); it != std::end(range); ++it, ++nIndex)
+	{
+		auto element = *it;
+
+		LambdaRequest* pRequest = new LambdaRequest([stream, function, element, nIndex]() {
+			TTraits::Complete(*stream, nIndex, *function, element);
+		});
+
+		// The consumer expects an entry for each input, so an input, that can not be queued, is reported as failed.
+		if (!pool.QueueRequest(pRequest))
+		{
+			delete pRequest;
+			stream->Fail(nIndex, E_FAIL);
+		}
+	}
+
+	return stream;
+}
+
+#if defined(ATLS_POOLEX_COROUTINES)
+
+/// <summary>
+/// A lazily started coroutine, that forks child tasks with <see cref="Spawn">`Spawn`</see> and joins them with <see cref="Sync">`Sync`</see>.
+/// </summary>
+/// <remarks>
+/// Spawning uses continuation stealing: the child is executed immediately on the current thread and the continuation of the parent is pushed to the deque of the
+/// worker, from where idle workers can steal it. If the continuation has not been stolen when the child returns, the parent continues on the same thread like
+/// after a regular call. Control is transferred symmetrically between the coroutines, so that the stack does not grow with the recursion depth and each thread
+/// holds at most one chain of frames from the root to the current task, which bounds the memory of a recursive computation by the memory of its serial
+/// execution times the number of workers. A task must sync its children before it returns. Exceptions must not leave a task.
+/// </remarks>
+class CForkJoinTask
+{
+public:
+	struct promise_type;
+
+	/// <summary>
+	/// Returns control to the parent after a task has returned and destroys the frame of the task.
+	/// </summary>
+	struct CFinalAwaitable
+	{
+		bool await_ready() noexcept
+		{
+			return false;
+		}
+
+		inline std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> task) noexcept;
+
+		void await_resume() noexcept
+		{
+		}
+	};
+
+	struct promise_type
+	{
+		CScopedTaskScheduler* m_pScheduler;
+		std::coroutine_handle<promise_type> m_parent;
+		CContinuationDeque* m_pDeque;
+		volatile LONG m_lPending;
+		HANDLE m_hCompleted;
+
+		promise_type() throw() :
+			m_pScheduler(nullptr), m_pDeque(nullptr), m_lPending(1), m_hCompleted(nullptr)
+		{
+		}
+
+		CForkJoinTask get_return_object() throw()
+		{
+			return CForkJoinTask(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		std::suspend_always initial_suspend() throw()
+		{
+			return std::suspend_always();
+		}
+
+		CFinalAwaitable final_suspend() noexcept
+		{
+			return CFinalAwaitable();
+		}
+
+		void return_void() throw()
+		{
+			ATLASSERT(m_lPending == 1);
+		}
+
+		void unhandled_exception() throw()
+		{
+			std::terminate();
+		}
+	};
+
+private:
+	std::coroutine_handle<promise_type> m_handle;
+
+	explicit CForkJoinTask(std::coroutine_handle<promise_type> handle) throw() :
+		m_handle(handle)
+	{
+	}
+
+public:
+	CForkJoinTask(CForkJoinTask&& task) throw() :
+		m_handle(task.m_handle)
+	{
+		task.m_handle = nullptr;
+	}
+
+	~CForkJoinTask() throw()
+	{
+		if (m_handle)
+			m_handle.destroy();
+	}
+
+private:
+	CForkJoinTask(const CForkJoinTask& task) = delete;
+
+public:
+	/// <summary>
+	/// Transfers the ownership of the coroutine frame to the caller.
+	/// </summary>
+	std::coroutine_handle<promise_type> Detach() throw()
+	{
+		std::coroutine_handle<promise_type> handle = m_handle;
+		m_handle = nullptr;
+
+		return handle;
+	}
+
+	/// <summary>
+	/// Resumes a coroutine, that has been pushed as a continuation.
+	/// </summary>
+	static void ResumeContinuation(LPVOID pvFrame)
+	{
+		std::coroutine_handle<>::from_address(pvFrame).resume();
+	}
+};
+
+std::coroutine_handle<> CForkJoinTask::CFinalAwaitable::await_suspend(std::coroutine_handle<promise_type> task) noexcept
+{
+	promise_type& promise = task.promise();
+
+	if (!promise.m_parent)
+	{
+		// The root task is destroyed by the thread, that waits for it.
+		::SetEvent(promise.m_hCompleted);
+		return std::noop_coroutine();
+	}
+
+	std::coroutine_handle<promise_type> parent = promise.m_parent;
+	CScopedTaskScheduler& scheduler = *promise.m_pScheduler;
+	BOOL bRemoved = scheduler.RemoveContinuation(*promise.m_pDeque, reinterpret_cast<ULONG_PTR>(task.address()));
+
+	task.destroy();
+
+	promise_type& parentPromise = parent.promise();
+
+	if (bRemoved)
+	{
+		// The continuation has not been stolen, so the parent has not reached its sync yet and continues on this thread.
+		::InterlockedDecrement(&parentPromise.m_lPending);
+		return parent;
+	}
+
+	// The last child of a stolen parent resumes it, after it has suspended at its sync.
+	if (::InterlockedDecrement(&parentPromise.m_lPending) != 0)
+		return std::noop_coroutine();
+
+	parentPromise.m_lPending = 1;
+	return parent;
+}
+
+/// <summary>
+/// An awaitable, that executes a child task on the current thread and makes the continuation of the parent stealable.
+/// </summary>
+class CSpawnAwaitable
+{
+private:
+	std::coroutine_handle<CForkJoinTask::promise_type> m_child;
+
+public:
+	explicit CSpawnAwaitable(CForkJoinTask&& task) throw() :
+		m_child(task.Detach())
+	{
+	}
+
+public:
+	bool await_ready() const throw()
+	{
+		return false;
+	}
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<CForkJoinTask::promise_type> parent)
+	{
+		// The parent may be resumed by a thief as soon as its continuation has been pushed, so the awaitable must not be accessed afterwards.
+		std::coroutine_handle<CForkJoinTask::promise_type> child = m_child;
+		CForkJoinTask::promise_type& parentPromise = parent.promise();
+		CScopedTaskScheduler& scheduler = *parentPromise.m_pScheduler;
+		CContinuationDeque& deque = scheduler.GetContinuationDeque();
+
+		child.promise().m_pScheduler = &scheduler;
+		child.promise().m_parent = parent;
+		child.promise().m_pDeque = &deque;
+
+		::InterlockedIncrement(&parentPromise.m_lPending);
+
+		CContinuation continuation = { &CForkJoinTask::ResumeContinuation, parent.address(), reinterpret_cast<ULONG_PTR>(child.address()) };
+		scheduler.PushContinuation(deque, continuation);
+
+		return child;
+	}
+
+	void await_resume() throw()
+	{
+	}
+};
+
+/// <summary>
+/// An awaitable, that suspends a task until all of its spawned children have returned.
+/// </summary>
+class CSyncAwaitable
+{
+private:
+	volatile LONG* m_plPending;
+
+public:
+	CSyncAwaitable() throw() :
+		m_plPending(nullptr)
+	{
+	}
+
+public:
+	bool await_ready() const throw()
+	{
+		return false;
+	}
+
+	bool await_suspend(std::coroutine_handle<CForkJoinTask::promise_type> task) throw()
+	{
+		volatile LONG& lPending = task.promise().m_lPending;
+
+		// Only the task itself adds children, so that all of them have returned, if no child holds a reference.
+		if (lPending == 1)
+			return false;
+
+		// Drop the reference of the task. Otherwise the last child resumes it and resets the counter.
+		if (::InterlockedDecrement(&lPending) != 0)
+			return true;
+
+		lPending = 1;
+		return false;
+	}
+
+	void await_resume() throw()
+	{
+	}
+};
+
+/// <summary>
+/// Executes `task` as a child of the calling task. The calling task may continue on another worker before the child returns.
+/// </summary>
+inline CSpawnAwaitable Spawn(CForkJoinTask&& task) throw()
+{
+	return CSpawnAwaitable(std::move(task));
+}
+
+/// <summary>
+/// Waits until all children, that have been spawned by the calling task, have returned.
+/// </summary>
+inline CSyncAwaitable Sync() throw()
+{
+	return CSyncAwaitable();
+}
+
+/// <summary>
+/// Executes a root task on the calling thread and returns after it has completed. Continuations of the task are stolen by the workers of `scheduler`.
+/// </summary>
+/// <remarks>
+/// If the calling thread is a worker of `scheduler`, it executes scoped tasks and steals continuations while it waits, instead of blocking a worker, that the
+/// task may depend on.
+/// </remarks>
+inline HRESULT SyncWait(CScopedTaskScheduler& scheduler, CForkJoinTask&& task)
+{
+	std::coroutine_handle<CForkJoinTask::promise_type> root = task.Detach();
+	HANDLE hCompleted = ::CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+	if (hCompleted == nullptr)
+	{
+		root.destroy();
+		return AtlHresultFromLastError();
+	}
+
+	root.promise().m_pScheduler = &scheduler;
+	root.promise().m_hCompleted = hCompleted;
+	root.resume();
+
+	if (scheduler.GetCurrentWorkerIndex() >= 0)
+	{
+		while (::WaitForSingleObject(hCompleted, 0) == WAIT_TIMEOUT)
+			if (!scheduler.DispatchPendingTask())
+				::SwitchToThread();
+	}
+	else
+		::WaitForSingleObject(hCompleted, INFINITE);
+
+	::CloseHandle(hCompleted);
+	root.destroy();
+
+	return S_OK;
+}
+#endif
+
+/// <summary>
+/// The default policy of `CThreadPoolEx`, that does not add any behavior to the execution of requests.
+/// </summary>
+/// <remarks>
+/// Policies are compile-time extension points of the pool. The pool calls `BeginExecute` before and `EndExecute` after a request is executed, and `OnIdle`
+/// before a worker waits for new requests. `CExecution` carries state from `BeginExecute` to `EndExecute`. If `BeginExecute` returns `FALSE`, the request is
+/// not executed. Policies only see requests, that are passed to the worker's `Execute`, whether they have been posted to the completion port or taken from a
+/// user-space queue. Scoped tasks, stolen continuations and completions of <see cref="CIoOperation">`CIoOperation`</see> instances bypass the policy.
+///
+/// This policy and its `CExecution` are empty classes, which is checked at compile time, and all of its methods are empty, so it adds neither state nor work
+/// to the pool, unless the compiler does not inline the calls. Its dispatch cost has not been benchmarked against a hand-written queue. Derive from this class
+/// to implement a policy, that only provides some of the methods.
+/// </remarks>
+class CNullPoolPolicy
+{
+public:
+	struct CExecution
+	{
+	};
+
+public:
+	/// <summary>
+	/// Called by a worker before it executes `request`. Returns `FALSE`, if the request must not be executed.
+	/// </summary>
+	/// <remarks>
+	/// A declined request is owned by the same party as an executed one: requests, that the worker releases in `Execute`, must be released by the policy,
+	/// while requests owned by the pool, like the batches of <see cref="CBatchThreadPoolEx">`CBatchThreadPoolEx`</see>, are recycled by the pool either way.
+	/// </remarks>
+	template <class TWorker, class TRequest>
+	BOOL BeginExecute(TWorker& theWorker, TRequest request, LPVOID config, CExecution& execution) throw()
+	{
+		return TRUE;
+	}
+
+	/// <summary>
+	/// Called by a worker after it has executed a request, for which `BeginExecute` has returned `TRUE`.
+	/// </summary>
+	void EndExecute(CExecution& execution) throw()
+	{
+	}
+
+	/// <summary>
+	/// Called by a worker before it waits for new requests.
+	/// </summary>
+	void OnIdle() throw()
+	{
+	}
+};
+
+/// <summary>
+/// A pool policy, that counts executed requests, their total execution time and the number of times workers became idle.
+/// </summary>
+class CStatisticsPoolPolicy :
+	public CNullPoolPolicy
+{
+public:
+	struct CExecution
+	{
+		LONGLONG m_llStart;
+	};
+
+private:
+	volatile LONG64 m_llExecuted;
+	volatile LONG64 m_llExecutionTicks;
+	volatile LONG64 m_llIdle;
+	double m_dTicksPerMicrosecond;
+
+public:
+	CStatisticsPoolPolicy() throw() :
+		m_llExecuted(0), m_llExecutionTicks(0), m_llIdle(0)
+	{
+		LARGE_INTEGER frequency;
+		::QueryPerformanceFrequency(&frequency);
+		m_dTicksPerMicrosecond = static_cast<double>(frequency.QuadPart) / 1000000.0;
+	}
+
+public:
+	template <class TWorker, class TRequest>
+	BOOL BeginExecute(TWorker& theWorker, TRequest request, LPVOID config, CExecution& execution) throw()
+	{
+		LARGE_INTEGER counter;
+		::QueryPerformanceCounter(&counter);
+		execution.m_llStart = counter.QuadPart;
+
+		return TRUE;
+	}
+
+	void EndExecute(CExecution& execution) throw()
+	{
+		LARGE_INTEGER counter;
+		::QueryPerformanceCounter(&counter);
+
+		::InterlockedIncrement64(&m_llExecuted);
+		::InterlockedExchangeAdd64(&m_llExecutionTicks, counter.QuadPart - execution.m_llStart);
+	}
+
+	void OnIdle() throw()
+	{
+		::InterlockedIncrement64(&m_llIdle);
+	}
+
+	/// <summary>
+	/// Returns the number of executed requests.
+	/// </summary>
+	LONG64 GetExecutedRequests() const throw()
+	{
+		return m_llExecuted;
+	}
+
+	/// <summary>
+	/// Returns the total execution time of all requests in microseconds.
+	/// </summary>
+	double GetExecutionTime() const throw()
+	{
+		return static_cast<double>(m_llExecutionTicks) / m_dTicksPerMicrosecond;
+	}
+
+	/// <summary>
+	/// Returns the number of times a worker has run out of requests.
+	/// </summary>
+	LONG64 GetIdleTransitions() const throw()
+	{
+		return m_llIdle;
+	}
+};
+
+/// <summary>
+/// The events reported by the <see cref="CTracingPoolPolicy">`CTracingPoolPolicy`</see>.
+/// </summary>
+enum class PoolTraceEvent
+{
+	BeginExecute,
+	EndExecute,
+	Idle
+};
+
+/// <summary>
+/// A pool policy, that reports the execution of requests and idle workers to a callback.
+/// </summary>
+/// <remarks>
+/// The callback receives the event, the context pointer passed to `SetTraceCallback` and the address of the request, which only serves as an identifier, since
+/// the request may already have been destroyed when `EndExecute` is reported. The callback must be set before the pool is initialized.
+/// </remarks>
+class CTracingPoolPolicy :
+	public CNullPoolPolicy
+{
+public:
+	typedef void (*TraceCallback)(PoolTraceEvent event, LPVOID pvContext, ULONG_PTR dwRequest);
+
+	struct CExecution
+	{
+		ULONG_PTR m_dwRequest;
+	};
+
+private:
+	TraceCallback m_pfnTrace;
+	LPVOID m_pvContext;
+
+public:
+	CTracingPoolPolicy() throw() :
+		m_pfnTrace(nullptr), m_pvContext(nullptr)
+	{
+	}
+
+public:
+	/// <summary>
+	/// Sets the callback, that receives the trace events.
+	/// </summary>
+	void SetTraceCallback(TraceCallback pfnTrace, LPVOID pvContext = nullptr) throw()
+	{
+		m_pfnTrace = pfnTrace;
+		m_pvContext = pvContext;
+	}
+
+	template <class TWorker, class TRequest>
+	BOOL BeginExecute(TWorker& theWorker, TRequest request, LPVOID config, CExecution& execution) throw()
+	{
+		execution.m_dwRequest = (ULONG_PTR) request;
+
+		if (m_pfnTrace != nullptr)
+			m_pfnTrace(PoolTraceEvent::BeginExecute, m_pvContext, execution.m_dwRequest);
+
+		return TRUE;
+	}
+
+	void EndExecute(CExecution& execution) throw()
+	{
+		if (m_pfnTrace != nullptr)
+			m_pfnTrace(PoolTraceEvent::EndExecute, m_pvContext, execution.m_dwRequest);
+	}
+
+	void OnIdle() throw()
+	{
+		if (m_pfnTrace != nullptr)
+			m_pfnTrace(PoolTraceEvent::Idle, m_pvContext, 0);
+	}
+};
+
+/// <summary>
+/// A pool policy, that does not execute requests, which have been cancelled before a worker has started them.
+/// </summary>
+/// <remarks>
+/// The request type must provide `IsCancelled`, like <see cref="CIntrusiveRequest">`CIntrusiveRequest`</see>, and the worker archetype must provide a method
+/// `Cancel(request, config)`, that is called instead of `Execute`. The policy does not own the request: `Cancel` follows the same ownership rules as `Execute`,
+/// so it releases requests, that `Execute` would release, but must not release requests owned by the pool, like the batches of
+/// <see cref="CBatchThreadPoolEx">`CBatchThreadPoolEx`</see>, which the pool recycles after `Cancel` has returned. A request stays cancelled, until
+/// `ResetCancellation` is called, so requests, that are reused, must be reset before they are queued again. Batches are reset, when they are recycled.
+/// </remarks>
+class CCancellationPoolPolicy :
+	public CNullPoolPolicy
+{
+public:
+	template <class TWorker, class TRequest>
+	BOOL BeginExecute(TWorker& theWorker, TRequest request, LPVOID config, CExecution& execution) throw()
+	{
+		if (!request->IsCancelled())
+			return TRUE;
+
+		theWorker.Cancel(request, config);
+
+		return FALSE;
+	}
+};
+
+/// <summary>
+/// A pool policy, that combines two policies. `TFirst` begins first and ends last. Nest combined policies to combine more than two.
+/// </summary>
+/// <remarks>
+/// If `TSecond` declines to execute a request, `TFirst::EndExecute` is not called either. Combine the `CCancellationPoolPolicy` as `TFirst`, so that other
+/// policies do not observe cancelled requests at all.
+/// </remarks>
+template <class TFirst, class TSecond>
+class CCombinedPoolPolicy :
+	public TFirst,
+	public TSecond
+{
+public:
+	struct CExecution
+	{
+		typename TFirst::CExecution m_first;
+		typename TSecond::CExecution m_second;
+	};
+
+public:
+	template <class TWorker, class TRequest>
+	BOOL BeginExecute(TWorker& theWorker, TRequest request, LPVOID config, CExecution& execution) throw()
+	{
+		return TFirst::BeginExecute(theWorker, request, config, execution.m_first) && TSecond::BeginExecute(theWorker, request, config, execution.m_second);
+	}
+
+	void EndExecute(CExecution& execution) throw()
+	{
+		TSecond::EndExecute(execution.m_second);
+		TFirst::EndExecute(execution.m_first);
+	}
+
+	void OnIdle() throw()
+	{
+		TFirst::OnIdle();
+		TSecond::OnIdle();
+	}
+};
+
+static_assert(std::is_empty<CNullPoolPolicy>::value && std::is_empty<CNullPoolPolicy::CExecution>::value, "The default policy must not add any state.");
+
+/// <summary>
+/// The completion packet, that wakes an idle worker in order to dispatch requests from a user-space queue.
+/// </summary>
+#define ATLS_POOLEX_WAKEUP ((OVERLAPPED*) ((__int64) -2))
+
+/// <summary>
+/// An extented worker thread.
+/// </summary>
+/// <remarks>
+/// The default `CThreadPool` implementation does not correctly remove a thread, if it's handle is closed on application shutdown, i.e. `GetQueuedCompletionStatus` returns `FALSE`.
+/// The extented thread pool fixes this issue. *
+/// </remarks>
+template <class TWorker, class TThreadTraits = ThreadProcHookThreadTraits<DefaultThreadTraits>, class TWaitTraits = DefaultWaitTraits, class TPolicy = CNullPoolPolicy>
+class CThreadPoolEx : 
+	public CThreadPool<TWorker, TThreadTraits, TWaitTraits>,
+	public CThreadProcHook,
+	public CScopedTaskScheduler
+{
+protected:
+	/// <summary>
+	/// The number of requests a worker dispatches from user-space queues, before it checks the completion port again.
+	/// </summary>
+	static const UINT DispatchBatchSize = 32;
+
+	/// <summary>
+	/// The part of a worker's stack, that is not pre-faulted, in order to leave room for the frames of `ThreadProc` and the guard page.
+	/// </summary>
+	static const SIZE_T WarmUpStackReserve = 64 * 1024;
+
+protected:
+	CEpochDomain m_epochDomain;
+	volatile LONG m_lIdleWorkers;
+	TPolicy m_policy;
+	SIZE_T m_nWarmUpStackSize;
+	SIZE_T m_nWarmUpScratchSize;
+	std::function<void(TWorker&, LPVOID)> m_warmUp;
+
+public:
+	CThreadPoolEx() throw() :
+		CThreadPool(), m_lIdleWorkers(0), m_nWarmUpStackSize(0), m_nWarmUpScratchSize(0)
+	{
+	}
+
+	virtual ~CThreadPoolEx() throw()
+	{
+		// Stop the workers before the members they access are destroyed.
+		Shutdown();
+	}
+
+public:
+	/// <summary>
+	/// Starts the workers of the pool.
+	/// </summary>
+	/// <remarks>
+	/// The method is virtual, so that pools, which start additional threads, also start them, if they are initialized through a `CThreadPoolEx` reference.
+	/// </remarks>
+	virtual HRESULT Initialize(void* pvWorkerParam = nullptr, int nNumThreads = 0, DWORD dwStackSize = 0, HANDLE hCompletion = INVALID_HANDLE_VALUE) throw()
+	{
+		return CThreadPool<TWorker, TThreadTraits, TWaitTraits>::Initialize(pvWorkerParam, nNumThreads, dwStackSize, hCompletion);
+	}
+
+	/// <summary>
+	/// Stops the workers of the pool, after they have executed the requests, that are still queued.
+	/// </summary>
+	/// <remarks>
+	/// The method is virtual, so that pools, which start additional threads, also stop them, if they are shut down through a `CThreadPoolEx` reference.
+	/// </remarks>
+	virtual void Shutdown(DWORD dwMaxWait = 0) throw()
+	{
+		CThreadPool<TWorker, TThreadTraits, TWaitTraits>::Shutdown(dwMaxWait);
+	}
+
+	/// <summary>
+	/// Returns the policy, that extends the execution of requests.
+	/// </summary>
+	TPolicy& GetPolicy() throw()
+	{
+		return m_policy;
+	}
+
+	/// <summary>
+	/// Returns the epoch domain, that protects shared data read by requests of this pool.
+	/// </summary>
+	CEpochDomain& GetEpochDomain() throw()
+	{
+		return m_epochDomain;
+	}
+
+	/// <summary>
+	/// Deletes an object, that has been unlinked from a structure shared between requests, after all workers have finished the requests they are currently executing.
+	/// </summary>
+	/// <remarks>
+	/// Requests may read structures protected this way without any locks or hazard pointers, as long as they do not keep references to them after they return.
+	/// </remarks>
+	template <class T>
+	void Retire(T* object)
+	{
+		m_epochDomain.Retire(object);
+	}
+
+	/// <summary>
+	/// Passes an object, that has been unlinked from a structure shared between requests, to `deleter` after all workers have finished the requests they are currently executing.
+	/// </summary>
+	template <class T, class TDeleter>
+	void Retire(T* object, TDeleter&& deleter)
+	{
+		m_epochDomain.Retire(object, std::forward<TDeleter>(deleter));
+	}
+
+	/// <summary>
+	/// Returns the number of workers, that execute scoped tasks.
+	/// </summary>
+	virtual int GetConcurrency() throw() override
+	{
+		return GetNumThreads();
+	}
+
+	/// <summary>
+	/// Associates a file, device or socket opened for overlapped I/O with the pool, so that its completions are dispatched to <see cref="CIoOperation">`CIoOperation`</see> instances.
+	/// </summary>
+	BOOL AssociateHandle(HANDLE hFile) throw()
+	{
+		return ::CreateIoCompletionPort(hFile, GetQueueHandle(), ATLS_POOLEX_IO_COMPLETION, 0) != nullptr;
+	}
+
+#if defined(ATLS_POOLEX_COROUTINES)
+	/// <summary>
+	/// Returns an awaitable, that continues the awaiting coroutine on a worker.
+	/// </summary>
+	CScheduleAwaitable Schedule() throw()
+	{
+		return CScheduleAwaitable(GetQueueHandle());
+	}
+
+	/// <summary>
+	/// Returns an awaitable, that continues the awaiting coroutine on a worker after `dwMilliseconds`.
+	/// </summary>
+	CSleepAwaitable SleepAsync(DWORD dwMilliseconds) throw()
+	{
+		return CSleepAwaitable(GetQueueHandle(), dwMilliseconds);
+	}
+
+	/// <summary>
+	/// Returns an awaitable, that reads from an associated handle and continues the awaiting coroutine on the worker, that receives the completion.
+	/// </summary>
+	CReadAwaitable ReadAsync(HANDLE hFile, LPVOID pBuffer, DWORD dwSize, ULONGLONG ullOffset = 0) throw()
+	{
+		return CReadAwaitable(hFile, pBuffer, dwSize, ullOffset);
+	}
+
+	/// <summary>
+	/// Returns an awaitable, that writes to an associated handle and continues the awaiting coroutine on the worker, that receives the completion.
+	/// </summary>
+	CWriteAwaitable WriteAsync(HANDLE hFile, LPCVOID pBuffer, DWORD dwSize, ULONGLONG ullOffset = 0) throw()
+	{
+		return CWriteAwaitable(hFile, pBuffer, dwSize, ullOffset);
+	}
+
+#if defined(_MSWSOCK_)
+	/// <summary>
+	/// Returns an awaitable, that accepts a connection on an associated listening socket and continues the awaiting coroutine on the worker, that receives the completion.
+	/// </summary>
+	CAcceptAwaitable AcceptAsync(SOCKET listenSocket, SOCKET acceptSocket) throw()
+	{
+		return CAcceptAwaitable(listenSocket, acceptSocket);
+	}
+#endif
+#endif
+
+	/// <summary>
+	/// Configures the warm-up phase, that each worker passes after it has been initialized and before `Initialize` or `SetSize` return.
+	/// </summary>
+	/// <remarks>
+	/// The first requests on a new worker otherwise pay for page faults on its stack and scratch buffer, as well as for cold caches. During the warm-up phase, a
+	/// worker commits `nStackSize` bytes of its stack (limited by the stack size, that is reserved for the worker), allocates and touches a scratch buffer of
+	/// `nScratchSize` bytes (see <see cref="CScopedTaskScheduler::GetScratchBuffer">`GetScratchBuffer`</see>), and finally calls `warmUp`, if provided, which
+	/// may execute a representative request on the worker. Call this method before `Initialize` or `SetSize`; workers, that are already running, are not affected.
+	/// </remarks>
+	void SetWarmUp(SIZE_T nStackSize, SIZE_T nScratchSize, std::function<void(TWorker& theWorker, LPVOID config)> warmUp = nullptr)
+	{
+		m_nWarmUpStackSize = nStackSize;
+		m_nWarmUpScratchSize = nScratchSize;
+		m_warmUp = std::move(warmUp);
+	}
+
+protected:
+	/// <summary>
+	/// Passes a request to `theWorker`, surrounded by the calls to the pool's policy. Returns `FALSE`, if the policy has declined to execute the request. Scoped
+	/// tasks, continuations and I/O completions are not dispatched here.
+	/// </summary>
+	BOOL ExecuteRequest(TWorker& theWorker, typename TWorker::RequestType request, OVERLAPPED* pOverlapped) throw()
+	{
+		typename TPolicy::CExecution execution;
+
+		if (!m_policy.BeginExecute(theWorker, request, m_pvWorkerParam, execution))
+			return FALSE;
+
+		theWorker.Execute(request, m_pvWorkerParam, pOverlapped);
+
+		m_policy.EndExecute(execution);
+
+		return TRUE;
+	}
+
+	/// <summary>
+	/// Override this method to dispatch a request from a user-space queue to `theWorker`. Returns `FALSE`, if there are no queued requests.
+	/// </summary>
+	/// <remarks>
+	/// Workers, that are stopped, call this method until it returns `FALSE`, so requests queued before `Shutdown` are executed rather than dropped.
+	/// </remarks>
+	virtual BOOL DispatchQueuedRequest(TWorker& theWorker) throw()
+	{
+		return FALSE;
+	}
+
+	/// <summary>
+	/// Override this method to return `TRUE`, if a user-space queue contains requests, that can be dispatched by `DispatchQueuedRequest`.
+	/// </summary>
+	virtual BOOL HasQueuedRequests() const throw()
+	{
+		return FALSE;
+	}
+
+	/// <summary>
+	/// Wakes up an idle worker after a request has been added to a user-space queue.
+	/// </summary>
+	/// <remarks>
+	/// Workers only block on the completion port after they have registered as idle and found all user-space queues empty afterwards. Since the request is
+	/// queued before the idle workers are counted, either an idle worker is woken up here, or the worker finds the request when it checks the queues again.
+	/// </remarks>
+	virtual void WakeIdleWorker() throw() override
+	{
+		::MemoryBarrier();
+
+		if (ClaimIdleWorker(m_lIdleWorkers))
+			PostQueuedCompletionStatus(m_hRequestQueue, 0, 0, ATLS_POOLEX_WAKEUP);
+	}
+
+	/// <summary>
+	/// Decrements a count of idle workers, unless it is zero. Returns `FALSE`, if there are no idle workers.
+	/// </summary>
+	static BOOL ClaimIdleWorker(volatile LONG& lIdleWorkers) throw()
+	{
+		for (LONG lCurrent = lIdleWorkers; lCurrent > 0; lCurrent = lIdleWorkers)
+		{
+			if (::InterlockedCompareExchange(&lIdleWorkers, lCurrent - 1, lCurrent) == lCurrent)
+				return TRUE;
+		}
+
+		return FALSE;
+	}
+
+private:
+	/// <summary>
+	/// Commits `nSize` bytes of the calling thread's stack, by touching each page below the current frame.
+	/// </summary>
+	static __declspec(noinline) void PrefaultStack(SIZE_T nSize) throw()
+	{
+		SYSTEM_INFO systemInfo;
+		::GetSystemInfo(&systemInfo);
+
+		volatile BYTE* pStack = static_cast<volatile BYTE*>(_alloca(nSize));
+
+		// Touch the pages from the top, so that the guard page moves down one page at a time.
+		for (SIZE_T nOffset = nSize; nOffset > 0; nOffset -= (std::min)(nOffset, static_cast<SIZE_T>(systemInfo.dwPageSize)))
+			pStack[nOffset - 1] = 0;
+	}
+
+	/// <summary>
+	/// Returns the size of the stack, that is reserved for threads, which are created with `dwStackSize`.
+	/// </summary>
+	/// <remarks>
+	/// `dwStackSize` is the initial commit size of the stack. The reservation is taken from the image header of the executable, unless `dwStackSize` is not
+	/// less than that, in which case it is rounded up to a multiple of 1 MB.
+	/// </remarks>
+	static SIZE_T GetStackReserve(DWORD dwStackSize) throw()
+	{
+		static const SIZE_T ReserveGranularity = 1024 * 1024;
+
+		const BYTE* pImage = reinterpret_cast<const BYTE*>(::GetModuleHandle(nullptr));
+		const IMAGE_DOS_HEADER* pDosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(pImage);
+		const IMAGE_NT_HEADERS* pNtHeaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(pImage + pDosHeader->e_lfanew);
+		SIZE_T nReserve = static_cast<SIZE_T>(pNtHeaders->OptionalHeader.SizeOfStackReserve);
+
+		if (dwStackSize >= nReserve)
+			nReserve = (static_cast<SIZE_T>(dwStackSize) + ReserveGranularity - 1) / ReserveGranularity * ReserveGranularity;
+
+		return nReserve;
+	}
+
+protected:
+	/// <summary>
+	/// Pre-faults the stack and scratch buffer of the calling worker and runs the warm-up callback, as configured by `SetWarmUp`.
+	/// </summary>
+	void WarmUp(TWorker& theWorker) throw()
+	{
+		SIZE_T nStackSize = m_nWarmUpStackSize;
+		SIZE_T nStackLimit = GetStackReserve(m_dwStackSize);
+		nStackSize = (std::min)(nStackSize, nStackLimit > WarmUpStackReserve ? nStackLimit - WarmUpStackReserve : 0);
+
+		if (nStackSize != 0)
+			PrefaultStack(nStackSize);
+
+		if (m_nWarmUpScratchSize != 0)
+			::memset(CScopedTaskScheduler::GetScratchBuffer(m_nWarmUpScratchSize), 0, m_nWarmUpScratchSize);
+
+		if (m_warmUp)
+			m_warmUp(theWorker, m_pvWorkerParam);
+	}
+
+	/// <summary>
+	/// Calls `theWorker.Idle`, if the worker archetype provides such a method.
+	/// </summary>
+	template <class T>
+	static auto NotifyIdle(T& theWorker, LPVOID config, int) throw() -> decltype(theWorker.Idle(config), void())
+	{
+		theWorker.Idle(config);
+	}
+
+	template <class T>
+	static void NotifyIdle(T& theWorker, LPVOID config, long) throw()
+	{
+	}
+
+private:
+	/// <summary>
+	/// Removes the calling worker from the idle workers, unless it has already been woken up by `WakeIdleWorker`.
+	/// </summary>
+	void LeaveIdle() throw()
+	{
+		ClaimIdleWorker(m_lIdleWorkers);
+	}
+
+protected:
+	virtual DWORD CThreadProcHook::ThreadProc() throw() override
+	{
+		DWORD dwBytesTransfered;
+		ULONG_PTR dwCompletionKey;
+
+		OVERLAPPED* pOverlapped;
+
+		// this block is to ensure theWorker gets destructed before the
+		// thread handle is closed
+		{
+			// We instantiate an instance of the worker class on the stack
+			// for the life time of the thread.
+			TWorker theWorker;
+
+			// The participant announces the quiescent states of this worker to the epoch domain.
+			CEpochParticipant participant;
+
+			if (theWorker.Initialize(m_pvWorkerParam) == FALSE)
+			{
+				return 1;
+			}
+
+			m_epochDomain.Register(participant);
+			m_epochDomain.Online(participant);
+			this->EnterWorker();
+
+			// Only report the worker as ready, after the first requests it executes do not have to fault in memory anymore.
+			this->WarmUp(theWorker);
+
+			SetEvent(m_hThreadEvent);
+
+			UINT nDispatched = 0;
+			BOOL bPolled = FALSE;
+
+			// Get the request from the IO completion port
+			while (TRUE)
+			{
+				// Requests from user-space queues are dispatched without a round-trip through the completion port. The port is still checked after a batch of
+				// requests, in order to not starve requests and shutdown notifications posted to it directly.
+				if (nDispatched < DispatchBatchSize && (this->DispatchScopedTask() || this->DispatchContinuation() || this->DispatchQueuedRequest(theWorker)))
+				{
+					nDispatched++;
+					bPolled = FALSE;
+					m_epochDomain.Quiesce(participant);
+					continue;
+				}
+
+				DWORD dwTimeout = INFINITE;
+
+				if (!bPolled)
+				{
+					// Poll the completion port first, since it may still hold requests, and the user-space queues may still hold requests after a full batch. The
+					// worker only becomes idle, if the poll times out.
+					dwTimeout = 0;
+					nDispatched = 0;
+					bPolled = TRUE;
+				}
+				else
+				{
+					// The worker would block otherwise, so it can finish deferred work, like destroying completed requests.
+					NotifyIdle(theWorker, m_pvWorkerParam, 0);
+					m_policy.OnIdle();
+
+					::InterlockedIncrement(&m_lIdleWorkers);
+
+					// Check the queues again, since a request might have been queued before this worker has been counted as idle.
+					if (this->HasScopedTasks() || this->HasContinuations() || this->HasQueuedRequests())
+					{
+						this->LeaveIdle();
+						continue;
+					}
+
+					// The worker does not hold any references to shared data while it waits for the next request.
+					m_epochDomain.Offline(participant);
+
+					if (m_epochDomain.HasRetiredObjects())
+						m_epochDomain.Collect();
+				}
+
+				// Request the queue status.
+				BOOL bStatus = GetQueuedCompletionStatus(m_hRequestQueue, &dwBytesTransfered, &dwCompletionKey, &pOverlapped, dwTimeout);
+				DWORD dwError = bStatus ? ERROR_SUCCESS : GetLastError();
+
+				if (dwTimeout == INFINITE)
+				{
+					m_epochDomain.Online(participant);
+
+					// Wake-up notifications have already removed the worker from the idle workers.
+					if (pOverlapped != ATLS_POOLEX_WAKEUP)
+						this->LeaveIdle();
+				}
+				else if (!bStatus && pOverlapped == nullptr && dwError == WAIT_TIMEOUT)
+				{
+					// There are no requests at the completion port.
+					continue;
+				}
+				else if (pOverlapped == ATLS_POOLEX_WAKEUP)
+				{
+					// The notification has been meant for a worker, that still waits, so count that worker as idle again. This worker handles the work.
+					::InterlockedIncrement(&m_lIdleWorkers);
+				}
+
+				// Poll the port again after this packet, before the worker becomes idle.
+				bPolled = FALSE;
+
+				if (pOverlapped != nullptr && dwCompletionKey == ATLS_POOLEX_IO_COMPLETION)
+				{
+					// Asynchronous operations are completed, even if they have failed.
+					static_cast<CIoOperation*>(pOverlapped)->OnComplete(dwError, dwBytesTransfered);
+				}
+				else if (pOverlapped == ATLS_POOL_SHUTDOWN) // Shut down
+				{
+					LONG bResult = InterlockedExchange(&m_bShutdown, FALSE);
+					if (bResult) // Shutdown has not been cancelled
+					{
+						// Requests in user-space queues are not owned by the completion port, so they are executed, before the worker exits, instead of being dropped.
+						while (this->DispatchQueuedRequest(theWorker))
+							m_epochDomain.Quiesce(participant);
+
+						break;
+					}
+
+					// else, shutdown has been cancelled -- continue as before
+				}
+				else if (pOverlapped == ATLS_POOLEX_WAKEUP)
+				{
+					// A request has been added to a user-space queue.
+					continue;
+				}
+				else if (bStatus)										// Do work
+				{
+					typename TWorker::RequestType request = (typename TWorker::RequestType) dwCompletionKey;
+
+					// Process the request.  Notice the following:
+					// (1) It is the worker's responsibility to free any memory associated
+					// with the request if the request is complete
+					// (2) If the request still requires some more processing
+					// the worker should queue the request again for dispatching
+					this->ExecuteRequest(theWorker, request, pOverlapped);
+				}
+				else
+				{
+					// GetQueuedCompletionStatus returned false (e.g. on application shutdown) and ATLS_POOL_SHUTDOWN has not been set.
+					break;
+				}
+
+				// Workers, that keep receiving requests from the port, do not go offline, so they need to announce their quiescent states here.
+				m_epochDomain.Quiesce(participant);
+			}
+
+			NotifyIdle(theWorker, m_pvWorkerParam, 0);
+
+			this->LeaveWorker();
+			m_epochDomain.Unregister(participant);
+
+			theWorker.Terminate(m_pvWorkerParam);
+		}
+
+		m_dwThreadEventId = GetCurrentThreadId();
+		SetEvent(m_hThreadEvent);
+
+		return 0;
+	}
+};
+
+/// <summary>
+/// A thread pool, that queues requests derived from <see cref="CIntrusiveRequest">`CIntrusiveRequest`</see> in a user-space queue.
+/// </summary>
+/// <remarks>
+/// Queueing a request does not allocate any memory, since the request embeds the queue link. Posting to the completion port is only required, if there are idle
+/// workers, that need to be woken up. Busy workers dispatch queued requests directly. Requests, that are still queued, when the pool is shut down, are
+/// executed by the stopping workers, so every queued request is executed exactly once.
+/// </remarks>
+template <class TWorker, class TThreadTraits = ThreadProcHookThreadTraits<DefaultThreadTraits>, class TWaitTraits = DefaultWaitTraits, class TPolicy = CNullPoolPolicy>
+class CIntrusiveThreadPoolEx :
+	public CThreadPoolEx<TWorker, TThreadTraits, TWaitTraits, TPolicy>
+{
+	static_assert(std::is_base_of<CIntrusiveRequest, typename std::remove_pointer<typename TWorker::RequestType>::type>::value, "The request type must be derived from CIntrusiveRequest.");
+
+protected:
+	CIntrusiveRequestQueue m_requestQueue;
+
+public:
+	virtual ~CIntrusiveThreadPoolEx() throw()
+	{
+		Shutdown();
+	}
+
+public:
+	/// <summary>
+	/// Queues a request for execution by a worker.
+	/// </summary>
+	BOOL QueueRequest(typename TWorker::RequestType request) throw()
+	{
+		m_requestQueue.Push(request);
+		this->WakeIdleWorker();
+
+		return TRUE;
+	}
+
+protected:
+	virtual BOOL DispatchQueuedRequest(TWorker& theWorker) throw() override
+	{
+		// Prefetching the next request overlaps its cache misses with the execution of this one, in case this worker takes it next.
+		CIntrusiveRequest* pRequest = m_requestQueue.PopAndPrefetchNext();
+
+		if (pRequest == nullptr)
+			return FALSE;
+
+		this->ExecuteRequest(theWorker, static_cast<typename TWorker::RequestType>(pRequest), nullptr);
+
+		return TRUE;
+	}
+
+	virtual BOOL HasQueuedRequests() const throw() override
+	{
+		return !m_requestQueue.IsEmpty();
+	}
+};
+
+/// <summary>
+/// A bounded multi-producer, multi-consumer ring, that stores trivially copyable requests inline within fixed-size slots.
+/// </summary>
+/// <remarks>
+/// Each slot stores a sequence number next to the request. The sequence tells producers and consumers, if the slot is free or contains a request for the
+/// current lap around the ring, so that slots can be claimed with a single compare-and-swap of the enqueue or dequeue position.
+/// </remarks>
+template <class TRequest, SIZE_T nQueueLength, SIZE_T nSlotSize>
+class CInlineRequestRing
+{
+	static_assert(std::is_trivially_copyable<TRequest>::value, "Inline requests must be trivially copyable.");
+	static_assert(sizeof(TRequest) <= nSlotSize - sizeof(LONG64), "The request type does not fit into a slot.");
+	static_assert(alignof(TRequest) <= alignof(LONG64), "The request type must not require an alignment larger than 8 bytes.");
+	static_assert(nQueueLength != 0 && (nQueueLength & (nQueueLength - 1)) == 0, "The queue length must be a power of two.");
+
+private:
+	struct CSlot
+	{
+		volatile LONG64 m_llSequence;
+		BYTE m_request[nSlotSize - sizeof(LONG64)];
+	};
+
+private:
+	DECLSPEC_CACHEALIGN volatile LONG64 m_llEnqueuePosition;
+	DECLSPEC_CACHEALIGN volatile LONG64 m_llDequeuePosition;
+	DECLSPEC_CACHEALIGN CSlot m_slots[nQueueLength];
+
+public:
+	CInlineRequestRing() throw() :
+		m_llEnqueuePosition(0), m_llDequeuePosition(0)
+	{
+		for (SIZE_T i = 0; i < nQueueLength; i++)
+			m_slots[i].m_llSequence = static_cast<LONG64>(i);
+	}
+
+private:
+	CInlineRequestRing(const CInlineRequestRing& ring) = delete;
+
+public:
+	/// <summary>
+	/// Returns `TRUE`, if there are no requests in the ring.
+	/// </summary>
+	BOOL IsEmpty() const throw()
+	{
+		return m_llDequeuePosition == m_llEnqueuePosition;
+	}
+
+	/// <summary>
+	/// Copies a request into the next free slot. Returns `FALSE`, if the ring is full.
+	/// </summary>
+	BOOL Push(const TRequest& request) throw()
+	{
+		LONG64 llPosition = m_llEnqueuePosition;
+		CSlot* pSlot;
+
+		while (TRUE)
+		{
+			pSlot = &m_slots[llPosition & (nQueueLength - 1)];
+			LONG64 llDifference = pSlot->m_llSequence - llPosition;
+
+			if (llDifference == 0)
+			{
+				LONG64 llCurrent = ::InterlockedCompareExchange64(&m_llEnqueuePosition, llPosition + 1, llPosition);
+
+				if (llCurrent == llPosition)
+					break;
+
+				llPosition = llCurrent;
+			}
+			else if (llDifference < 0)
+			{
+				// The slot still contains a request from the previous lap.
+				return FALSE;
+			}
+			else
+			{
+				llPosition = m_llEnqueuePosition;
+			}
+		}
+
+		::memcpy(pSlot->m_request, &request, sizeof(TRequest));
+
+		// Publish the request to consumers.
+		::InterlockedExchange64(&pSlot->m_llSequence, llPosition + 1);
+
+		return TRUE;
+	}
+
+	/// <summary>
+	/// Copies the oldest request to `request` and releases its slot. Returns `FALSE`, if the ring is empty.
+	/// </summary>
+	BOOL Pop(TRequest* request) throw()
+	{
+		LONG64 llPosition = m_llDequeuePosition;
+		CSlot* pSlot;
+
+		while (TRUE)
+		{
+			pSlot = &m_slots[llPosition & (nQueueLength - 1)];
+			LONG64 llDifference = pSlot->m_llSequence - (llPosition + 1);
+
+			if (llDifference == 0)
+			{
+				LONG64 llCurrent = ::InterlockedCompareExchange64(&m_llDequeuePosition, llPosition + 1, llPosition);
+
+				if (llCurrent == llPosition)
+					break;
+
+				llPosition = llCurrent;
+			}
+			else if (llDifference < 0)
+			{
+				// The slot has not yet been published for this lap.
+				return FALSE;
+			}
+			else
+			{
+				llPosition = m_llDequeuePosition;
+			}
+		}
+
+		::memcpy(request, pSlot->m_request, sizeof(TRequest));
+
+		// Release the slot for the next lap.
+		::InterlockedExchange64(&pSlot->m_llSequence, llPosition + static_cast<LONG64>(nQueueLength));
+
+		return TRUE;
+	}
+};
+
+/// <summary>
+/// A thread pool, that copies trivially copyable requests into the slots of a fixed-size ring, instead of queueing pointers to heap-allocated requests.
+/// </summary>
+/// <remarks>
+/// Queueing a request does not allocate any memory. The worker copies the request from its slot onto its stack and passes a pointer to this copy to `Execute`,
+/// which must therefore not delete the request or keep a reference to it after it returns. `nSlotSize` is the size of a slot in bytes, including an 8 byte
+/// sequence number. The default places each slot on its own cache line.
+/// </remarks>
+template <class TWorker, SIZE_T nQueueLength = 1024, SIZE_T nSlotSize = SYSTEM_CACHE_ALIGNMENT_SIZE, class TThreadTraits = ThreadProcHookThreadTraits<DefaultThreadTraits>, class TWaitTraits = DefaultWaitTraits, class TPolicy = CNullPoolPolicy>
+class CInlineThreadPoolEx :
+	public CThreadPoolEx<TWorker, TThreadTraits, TWaitTraits, TPolicy>
+{
+public:
+	typedef typename std::remove_pointer<typename TWorker::RequestType>::type InlineRequestType;
+
+protected:
+	CInlineRequestRing<InlineRequestType, nQueueLength, nSlotSize> m_requestRing;
+
+public:
+	virtual ~CInlineThreadPoolEx() throw()
+	{
+		Shutdown();
+	}
+
+public:
+	/// <summary>
+	/// Copies a request into the queue. Returns `FALSE`, if the queue is full.
+	/// </summary>
+	BOOL QueueRequest(const InlineRequestType& request) throw()
+	{
+		if (!m_requestRing.Push(request))
+			return FALSE;
+
+		this->WakeIdleWorker();
+
+		return TRUE;
+	}
+
+protected:
+	virtual BOOL DispatchQueuedRequest(TWorker& theWorker) throw() override
+	{
+		typename std::aligned_storage<sizeof(InlineRequestType), alignof(InlineRequestType)>::type request;
+
+		if (!m_requestRing.Pop(reinterpret_cast<InlineRequestType*>(&request)))
+			return FALSE;
+
+		this->ExecuteRequest(theWorker, reinterpret_cast<InlineRequestType*>(&request), nullptr);
+
+		return TRUE;
+	}
+
+	virtual BOOL HasQueuedRequests() const throw() override
+	{
+		return !m_requestRing.IsEmpty();
+	}
+};
+
+/// <summary>
+/// A relaxed concurrent priority queue, that consists of multiple heaps, each protected by its own lock.
+/// </summary>
+/// <remarks>
+/// Elements are pushed onto a random heap. Pop compares the top elements of two random heaps and removes the better one. The returned element is not always the
+/// best element in the queue, but close to it with high probability, while contention on the locks is spread across all heaps. `TCompare` orders priorities
+/// like `std::priority_queue`, i.e. with `std::less` elements with a higher priority are popped first. The top priority of each heap is published under a
+/// sequence counter, so that it can be compared without locking the heap, which requires `TPriority` to be trivially copyable.
+/// </remarks>
+///
+/// <seealso cref="https://arxiv.org/abs/1411.1209">MultiQueues: Simpler, Faster, and Better Relaxed Concurrent Priority Queues</seealso>
+template <class TElement, class TPriority = double, class TCompare = std::less<TPriority>>
+class CMultiQueue
+{
+	static_assert(std::is_trivially_copyable<TPriority>::value, "Priorities must be trivially copyable.");
+
+private:
+	struct CEntry
+	{
+		TPriority m_priority;
+		TElement m_element;
+	};
+
+	struct CEntryCompare
+	{
+		TCompare m_compare;
+
+		bool operator()(const CEntry& lhs, const CEntry& rhs) const
+		{
+			return m_compare(lhs.m_priority, rhs.m_priority);
+		}
+	};
+
+	struct CHeap
+	{
+		SRWLOCK m_lock;
+		volatile LONG m_lSize;
+
+		// The sequence counter is odd, while the top priority is being updated.
+		volatile LONG m_lVersion;
+		TPriority m_topPriority;
+		std::vector<CEntry> m_entries;
+
+		// Prevent false sharing of the locks of adjacent heaps.
+		BYTE m_padding[SYSTEM_CACHE_ALIGNMENT_SIZE];
+
+		CHeap() throw() :
+			m_lSize(0), m_lVersion(0), m_topPriority()
+		{
+			::InitializeSRWLock(&m_lock);
+		}
+	};
+
+	// Releases the exclusive lock of a heap, even if copying an entry throws.
+	struct CHeapLock
+	{
+		CHeap& m_heap;
+
+		explicit CHeapLock(CHeap& heap) throw() :
+			m_heap(heap)
+		{
+		}
+
+		~CHeapLock() throw()
+		{
+			::ReleaseSRWLockExclusive(&m_heap.m_lock);
+		}
+
+	private:
+		CHeapLock(const CHeapLock& lock) = delete;
+	};
+
+private:
+	std::unique_ptr<CHeap[]> m_heaps;
+	UINT m_nHeaps;
+	volatile LONG m_lSize;
+	CEntryCompare m_compare;
+
+public:
+	/// <summary>
+	/// Initializes a queue with `nQueuesPerProcessor` heaps for each logical processor.
+	/// </summary>
+	explicit CMultiQueue(UINT nQueuesPerProcessor = 2, const TCompare& compare = TCompare()) :
+		m_lSize(0)
+	{
+		SYSTEM_INFO systemInfo;
+		::GetSystemInfo(&systemInfo);
+
+		m_compare.m_compare = compare;
+		m_nHeaps = (std::max)(nQueuesPerProcessor * static_cast<UINT>(systemInfo.dwNumberOfProcessors), 2U);
+		m_heaps.reset(new CHeap[m_nHeaps]);
+	}
+
+private:
+	CMultiQueue(const CMultiQueue& queue) = delete;
+
+	static UINT Random() throw()
+	{
+		// A per-thread xorshift generator is sufficient to pick heaps.
+		static thread_local UINT32 s_uState = 0;
+
+		if (s_uState == 0)
+			s_uState = static_cast<UINT32>(::GetCurrentThreadId()) * 2654435761U | 1U;
+
+		s_uState ^= s_uState << 13;
+		s_uState ^= s_uState >> 17;
+		s_uState ^= s_uState << 5;
+
+		return s_uState;
+	}
+
+	// Publishes the priority of the top entry of a locked heap to readers, that do not lock it.
+	static void PublishTopPriority(CHeap& heap) throw()
+	{
+		::InterlockedIncrement(&heap.m_lVersion);
+		heap.m_topPriority = heap.m_entries.front().m_priority;
+		::InterlockedIncrement(&heap.m_lVersion);
+	}
+
+	// Reads the top priority of a heap without locking it. Returns `FALSE`, if the priority is updated concurrently.
+	static BOOL TryReadTopPriority(const CHeap& heap, TPriority& priority) throw()
+	{
+		LONG lVersion = heap.m_lVersion;
+		::MemoryBarrier();
+
+		if (lVersion & 1)
+			return FALSE;
+
+		priority = heap.m_topPriority;
+		::MemoryBarrier();
+
+		return heap.m_lVersion == lVersion;
+	}
+
+	BOOL TryPopFrom(CHeap& heap, TElement& element, BOOL bWait)
+	{
+		if (bWait)
+			::AcquireSRWLockExclusive(&heap.m_lock);
+		else if (!::TryAcquireSRWLockExclusive(&heap.m_lock))
+			return FALSE;
+
+		CHeapLock lock(heap);
+
+		if (heap.m_entries.empty())
+			return FALSE;
+
+		std::pop_heap(heap.m_entries.begin(), heap.m_entries.end(), m_compare);
+		element = heap.m_entries.back().m_element;
+		heap.m_entries.pop_back();
+
+		if (!heap.m_entries.empty())
+			PublishTopPriority(heap);
+
+		heap.m_lSize = static_cast<LONG>(heap.m_entries.size());
+		::InterlockedDecrement(&m_lSize);
+
+		return TRUE;
+	}
+
+public:
+	/// <summary>
+	/// Returns `TRUE`, if there are no elements in the queue.
+	/// </summary>
+	BOOL IsEmpty() const throw()
+	{
+		return m_lSize == 0;
+	}
+
+	/// <summary>
+	/// Inserts an element with the provided priority into a random heap.
+	/// </summary>
+	void Push(const TElement& element, const TPriority& priority)
+	{
+		CEntry entry = { priority, element };
+		CHeap* pHeap;
+
+		do
+		{
+			pHeap = &m_heaps[Random() % m_nHeaps];
+		} while (!::TryAcquireSRWLockExclusive(&pHeap->m_lock));
+
+		// The lock is released, if growing the heap throws, which leaves the heap unchanged.
+		CHeapLock lock(*pHeap);
+
+		pHeap->m_entries.push_back(entry);
+		std::push_heap(pHeap->m_entries.begin(), pHeap->m_entries.end(), m_compare);
+		PublishTopPriority(*pHeap);
+		pHeap->m_lSize = static_cast<LONG>(pHeap->m_entries.size());
+
+		::InterlockedIncrement(&m_lSize);
+	}
+
+	/// <summary>
+	/// Removes an element with a high priority from the queue. Returns `FALSE`, if the queue is empty.
+	/// </summary>
+	BOOL Pop(TElement& element)
+	{
+		for (UINT nAttempt = 0; m_lSize > 0; nAttempt++)
+		{
+			if (nAttempt < m_nHeaps)
+			{
+				// Compare the top elements of two random heaps without locking them, and pop from the better one.
+				CHeap& first = m_heaps[Random() % m_nHeaps];
+				CHeap& second = m_heaps[Random() % m_nHeaps];
+
+				CHeap* pHeap;
+				TPriority firstPriority;
+				TPriority secondPriority;
+
+				// A heap, whose top priority is updated concurrently, is skipped like an empty one.
+				if (first.m_lSize == 0 || !TryReadTopPriority(first, firstPriority))
+					pHeap = &second;
+				else if (second.m_lSize == 0 || !TryReadTopPriority(second, secondPriority))
+					pHeap = &first;
+				else
+					pHeap = m_compare.m_compare(firstPriority, secondPriority) ? &second : &first;
+
+				if (pHeap->m_lSize != 0 && this->TryPopFrom(*pHeap, element, FALSE))
+					return TRUE;
+			}
+			else
+			{
+				// Only a few elements are left, so search all heaps instead of relying on random picks.
+				for (UINT nHeap = 0; nHeap < m_nHeaps; nHeap++)
+					if (m_heaps[nHeap].m_lSize != 0 && this->TryPopFrom(m_heaps[nHeap], element, TRUE))
+						return TRUE;
+			}
+		}
+
+		return FALSE;
+	}
+};
+
+/// <summary>
+/// A thread pool, that dispatches requests approximately in the order of their priority, using a <see cref="CMultiQueue">`CMultiQueue`</see>.
+/// </summary>
+/// <remarks>
+/// Priorities can be any continuous value, for example the estimated cost of a node in a best-first search. Use `std::greater` as `TCompare` to dispatch
+/// requests with lower values first.
+/// </remarks>
+template <class TWorker, class TPriority = double, class TCompare = std::less<TPriority>, class TThreadTraits = ThreadProcHookThreadTraits<DefaultThreadTraits>, class TWaitTraits = DefaultWaitTraits, class TPolicy = CNullPoolPolicy>
+class CPriorityThreadPoolEx :
+	public CThreadPoolEx<TWorker, TThreadTraits, TWaitTraits, TPolicy>
+{
+protected:
+	CMultiQueue<typename TWorker::RequestType, TPriority, TCompare> m_requestQueue;
+
+public:
+	/// <summary>
+	/// Initializes the pool with `nQueuesPerProcessor` heaps for each logical processor.
+	/// </summary>
+	explicit CPriorityThreadPoolEx(UINT nQueuesPerProcessor = 2) :
+		m_requestQueue(nQueuesPerProcessor)
+	{
+	}
+
+	virtual ~CPriorityThreadPoolEx() throw()
+	{
+		Shutdown();
+	}
+
+public:
+	/// <summary>
+	/// Queues a request with the provided priority.
+	/// </summary>
+	BOOL QueueRequest(typename TWorker::RequestType request, const TPriority& priority)
+	{
+		m_requestQueue.Push(request, priority);
+		this->WakeIdleWorker();
+
+		return TRUE;
+	}
+
+protected:
+	virtual BOOL DispatchQueuedRequest(TWorker& theWorker) throw() override
+	{
+		typename TWorker::RequestType request;
+
+		if (!m_requestQueue.Pop(request))
+			return FALSE;
+
+		this->ExecuteRequest(theWorker, request, nullptr);
+
+		return TRUE;
+	}
+
+	virtual BOOL HasQueuedRequests() const throw() override
+	{
+		return !m_requestQueue.IsEmpty();
+	}
+};
+
+/// <summary>
+/// A thread pool, that reserves dedicated workers for urgent requests derived from <see cref="CIntrusiveRequest">`CIntrusiveRequest`</see>.
+/// </summary>
+/// <remarks>
+/// Besides the workers of the pool, which execute all requests and prefer urgent ones, the pool starts a fixed number of reserved workers, that only execute
+/// urgent requests and wait on a completion port of their own otherwise. An urgent request therefore never waits for a long-running request queued with
+/// `QueueRequest` to finish, unless all reserved workers are busy with other urgent requests. Reserved workers do not execute scoped tasks, nor completions of
+/// asynchronous operations. `Initialize` and `Shutdown` override the virtual methods of `CThreadPoolEx`, in order to start and stop the reserved workers.
+/// </remarks>
+template <class TWorker, class TThreadTraits = ThreadProcHookThreadTraits<DefaultThreadTraits>, class TWaitTraits = DefaultWaitTraits, class TPolicy = CNullPoolPolicy>
+class CReservedThreadPoolEx :
+	public CThreadPoolEx<TWorker, TThreadTraits, TWaitTraits, TPolicy>
+{
+	static_assert(std::is_base_of<CIntrusiveRequest, typename std::remove_pointer<typename TWorker::RequestType>::type>::value, "The request type must be derived from CIntrusiveRequest.");
+
+protected:
+	CIntrusiveRequestQueue m_requestQueue;
+	CIntrusiveRequestQueue m_urgentQueue;
+	int m_nReservedWorkers;
+	std::vector<HANDLE> m_reservedWorkers;
+	HANDLE m_hReservedQueue;
+	HANDLE m_hReservedEvent;
+	BOOL m_bReservedInitialized;
+	volatile LONG m_lIdleReservedWorkers;
+
+private:
+	/// <summary>
+	/// The thread parameter of the reserved workers, that tells them apart from the workers of the pool.
+	/// </summary>
+	/// <remarks>
+	/// Thread traits, that hook the thread proc, ignore the provided thread proc and call `ThreadProc` on the `CThreadProcHook` behind the parameter, which runs
+	/// the reserved worker loop of the pool. The configuration is forwarded to the pool.
+	/// </remarks>
+	class CReservedWorkerParam :
+		public IThreadPoolConfig,
+		public CThreadProcHook
+	{
+	private:
+		CReservedThreadPoolEx* m_pPool;
+
+	public:
+		explicit CReservedWorkerParam(CReservedThreadPoolEx* pPool) throw() :
+			m_pPool(pPool)
+		{
+		}
+
+	public:
+		HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) throw()
+		{
+			return m_pPool->QueryInterface(riid, ppv);
+		}
+
+		ULONG STDMETHODCALLTYPE AddRef() throw()
+		{
+			return m_pPool->AddRef();
+		}
+
+		ULONG STDMETHODCALLTYPE Release() throw()
+		{
+			return m_pPool->Release();
+		}
+
+		HRESULT STDMETHODCALLTYPE SetSize(int nNumThreads) throw()
+		{
+			return m_pPool->SetSize(nNumThreads);
+		}
+
+		HRESULT STDMETHODCALLTYPE GetSize(int* pnNumThreads) throw()
+		{
+			return m_pPool->GetSize(pnNumThreads);
+		}
+
+		HRESULT STDMETHODCALLTYPE SetTimeout(DWORD dwMaxWait) throw()
+		{
+			return m_pPool->SetTimeout(dwMaxWait);
+		}
+
+		HRESULT STDMETHODCALLTYPE GetTimeout(DWORD* pdwMaxWait) throw()
+		{
+			return m_pPool->GetTimeout(pdwMaxWait);
+		}
+
+		/// <summary>
+		/// Runs the reserved worker loop of the pool.
+		/// </summary>
+		DWORD Run() throw()
+		{
+			return m_pPool->ReservedThreadProc();
+		}
+
+	protected:
+		virtual DWORD CThreadProcHook::ThreadProc() throw() override
+		{
+			return this->Run();
+		}
+	};
+
+	CReservedWorkerParam m_reservedWorkerParam;
+
+public:
+	/// <summary>
+	/// Initializes the pool with `nReservedWorkers` workers, that are reserved for urgent requests.
+	/// </summary>
+	explicit CReservedThreadPoolEx(int nReservedWorkers = 1) throw() :
+		m_nReservedWorkers(nReservedWorkers), m_hReservedQueue(nullptr), m_hReservedEvent(nullptr), m_bReservedInitialized(FALSE), m_lIdleReservedWorkers(0),
+		m_reservedWorkerParam(this)
+	{
+	}
+
+	virtual ~CReservedThreadPoolEx() throw()
+	{
+		Shutdown();
+	}
+
+public:
+	/// <summary>
+	/// Starts the workers of the pool, followed by the reserved workers.
+	/// </summary>
+	virtual HRESULT Initialize(void* pvWorkerParam = nullptr, int nNumThreads = 0, DWORD dwStackSize = 0, HANDLE hCompletion = INVALID_HANDLE_VALUE) throw() override
+	{
+		HRESULT hr = CThreadPoolEx<TWorker, TThreadTraits, TWaitTraits, TPolicy>::Initialize(pvWorkerParam, nNumThreads, dwStackSize, hCompletion);
+
+		if (FAILED(hr))
+			return hr;
+
+		m_hReservedQueue = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0);
+		m_hReservedEvent = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+
+		if (m_hReservedQueue == nullptr || m_hReservedEvent == nullptr)
+		{
+			hr = AtlHresultFromLastError();
+			this->Shutdown();
+
+			return hr;
+		}
+
+		for (int nWorker = 0; nWorker < m_nReservedWorkers; nWorker++)
+		{
+			// Reserved workers are created by the same thread traits as the workers of the pool. Their thread parameter selects the reserved worker loop,
+			// whether the traits call the provided thread proc or hook it.
+			DWORD dwThreadId;
+			HANDLE hThread = TThreadTraits::CreateThread(nullptr, dwStackSize, &CReservedThreadPoolEx::ReservedThreadProc, static_cast<IThreadPoolConfig*>(&m_reservedWorkerParam), 0, &dwThreadId);
+
+			if (hThread == nullptr)
+			{
+				hr = AtlHresultFromLastError();
+				this->Shutdown();
+
+				return hr;
+			}
+
+			m_reservedWorkers.push_back(hThread);
+
+			// Wait for the worker to be initialized, before its result is evaluated.
+			::WaitForSingleObject(m_hReservedEvent, INFINITE);
+
+			if (!m_bReservedInitialized)
+			{
+				this->Shutdown();
+
+				return E_FAIL;
+			}
+		}
+
+		return S_OK;
+	}
+
+	/// <summary>
+	/// Stops the reserved workers, after they have finished their current requests, followed by the workers of the pool.
+	/// </summary>
+	/// <remarks>
+	/// Urgent requests, that are still queued, are executed by the workers of the pool, which drain both queues before they exit.
+	/// </remarks>
+	virtual void Shutdown(DWORD dwMaxWait = 0) throw() override
+	{
+		for (SIZE_T nWorker = 0; nWorker < m_reservedWorkers.size(); nWorker++)
+			::PostQueuedCompletionStatus(m_hReservedQueue, 0, 0, ATLS_POOL_SHUTDOWN);
+
+		for (SIZE_T nWorker = 0; nWorker < m_reservedWorkers.size(); nWorker++)
+		{
+			::WaitForSingleObject(m_reservedWorkers[nWorker], INFINITE);
+			::CloseHandle(m_reservedWorkers[nWorker]);
+		}
+
+		m_reservedWorkers.clear();
+
+		if (m_hReservedEvent != nullptr)
+		{
+			::CloseHandle(m_hReservedEvent);
+			m_hReservedEvent = nullptr;
+		}
+
+		if (m_hReservedQueue != nullptr)
+		{
+			::CloseHandle(m_hReservedQueue);
+			m_hReservedQueue = nullptr;
+		}
+
+		CThreadPoolEx<TWorker, TThreadTraits, TWaitTraits, TPolicy>::Shutdown(dwMaxWait);
+	}
+
+	/// <summary>
+	/// Queues a request, that is executed by the workers of the pool.
+	/// </summary>
+	BOOL QueueRequest(typename TWorker::RequestType request) throw()
+	{
+		m_requestQueue.Push(request);
+		this->WakeIdleWorker();
+
+		return TRUE;
+	}
+
+	/// <summary>
+	/// Queues an urgent request, that is executed by the next available reserved worker or worker of the pool.
+	/// </summary>
+	BOOL QueueUrgentRequest(typename TWorker::RequestType request) throw()
+	{
+		m_urgentQueue.Push(request);
+		::MemoryBarrier();
+
+		if (this->ClaimIdleWorker(m_lIdleReservedWorkers))
+			::PostQueuedCompletionStatus(m_hReservedQueue, 0, 0, ATLS_POOLEX_WAKEUP);
+		else
+			this->WakeIdleWorker();
+
+		return TRUE;
+	}
+
+protected:
+	virtual BOOL DispatchQueuedRequest(TWorker& theWorker) throw() override
+	{
+		CIntrusiveRequest* pRequest = m_urgentQueue.Pop();
+
+		if (pRequest == nullptr)
+			pRequest = m_requestQueue.Pop();
+
+		if (pRequest == nullptr)
+			return FALSE;
+
+		this->ExecuteRequest(theWorker, static_cast<typename TWorker::RequestType>(pRequest), nullptr);
+
+		return TRUE;
+	}
+
+	virtual BOOL HasQueuedRequests() const throw() override
+	{
+		return !m_urgentQueue.IsEmpty() || !m_requestQueue.IsEmpty();
+	}
+
+private:
+	static DWORD WINAPI ReservedThreadProc(LPVOID pv) throw()
+	{
+		return static_cast<CReservedWorkerParam*>(reinterpret_cast<IThreadPoolConfig*>(pv))->Run();
+	}
+
+	/// <summary>
+	/// Executes urgent requests on a reserved worker, until the worker receives a shutdown notification.
+	/// </summary>
+	DWORD ReservedThreadProc() throw()
+	{
+		DWORD dwBytesTransfered;
+		ULONG_PTR dwCompletionKey;
+		OVERLAPPED* pOverlapped;
+
+		TWorker theWorker;
+		CEpochParticipant participant;
+
+		m_bReservedInitialized = theWorker.Initialize(this->m_pvWorkerParam);
+
+		if (!m_bReservedInitialized)
+		{
+			::SetEvent(m_hReservedEvent);
+			return 1;
+		}
+
+		this->m_epochDomain.Register(participant);
+		this->m_epochDomain.Online(participant);
+		this->EnterWorker();
+		this->WarmUp(theWorker);
+
+		::SetEvent(m_hReservedEvent);
+
+		while (TRUE)
+		{
+			CIntrusiveRequest* pRequest = m_urgentQueue.Pop();
+
+			if (pRequest != nullptr)
+			{
+				this->ExecuteRequest(theWorker, static_cast<typename TWorker::RequestType>(pRequest), nullptr);
+				this->m_epochDomain.Quiesce(participant);
+				continue;
+			}
+
+			this->NotifyIdle(theWorker, this->m_pvWorkerParam, 0);
+			this->m_policy.OnIdle();
+
+			::InterlockedIncrement(&m_lIdleReservedWorkers);
+
+			// Check the queue again, since an urgent request might have been queued before this worker has been counted as idle.
+			if (!m_urgentQueue.IsEmpty())
+			{
+				this->ClaimIdleWorker(m_lIdleReservedWorkers);
+				continue;
+			}
+
+			this->m_epochDomain.Offline(participant);
+
+			if (this->m_epochDomain.HasRetiredObjects())
+				this->m_epochDomain.Collect();
+
+			::GetQueuedCompletionStatus(m_hReservedQueue, &dwBytesTransfered, &dwCompletionKey, &pOverlapped, INFINITE);
+
+			this->m_epochDomain.Online(participant);
+
+			// Wake-up notifications have already removed the worker from the idle workers.
+			if (pOverlapped != ATLS_POOLEX_WAKEUP)
+				this->ClaimIdleWorker(m_lIdleReservedWorkers);
+
+			if (pOverlapped == ATLS_POOL_SHUTDOWN || pOverlapped == nullptr)
+				break;
+		}
+
+		this->NotifyIdle(theWorker, this->m_pvWorkerParam, 0);
+
+		this->LeaveWorker();
+		this->m_epochDomain.Unregister(participant);
+
+		theWorker.Terminate(this->m_pvWorkerParam);
+
+		return 0;
+	}
+};
+
+/// <summary>
+/// Estimates the execution time of requests by their tag, using an exponentially weighted moving average and variance of measured durations.
+/// </summary>
+/// <remarks>
+/// Estimates are stored in a fixed-size open-addressing table, that is indexed by the tag. Each entry is updated under its own lock, so that workers recording
+/// the durations of requests with different tags do not contend. Samples for new tags are dropped, once the table is full. Durations are measured in
+/// microseconds.
+/// </remarks>
+class CRequestCostModel
+{
+private:
+	struct CEstimate
+	{
+		volatile LONG64 m_llKey;
+		SRWLOCK m_lock;
+		double m_dMean;
+		double m_dVariance;
+		ULONGLONG m_ullSamples;
+
+		CEstimate() throw() :
+			m_llKey(0), m_dMean(0.0), m_dVariance(0.0), m_ullSamples(0)
+		{
+			::InitializeSRWLock(&m_lock);
+		}
+	};
+
+private:
+	std::unique_ptr<CEstimate[]> m_estimates;
+	SIZE_T m_nMask;
+	double m_dSmoothing;
+	double m_dTicksPerMicrosecond;
+
+public:
+	/// <summary>
+	/// Initializes a model, that tracks up to `nCapacity` tags (rounded up to a power of two). Each sample contributes with a weight of `dSmoothing` to the
+	/// estimates of its tag.
+	/// </summary>
+	explicit CRequestCostModel(SIZE_T nCapacity = 1024, double dSmoothing = 0.125) :
+		m_dSmoothing(dSmoothing)
+	{
+		SIZE_T nSize = 1;
+
+		while (nSize < nCapacity)
+			nSize <<= 1;
+
+		m_estimates.reset(new CEstimate[nSize]);
+		m_nMask = nSize - 1;
+
+		LARGE_INTEGER frequency;
+		::QueryPerformanceFrequency(&frequency);
+		m_dTicksPerMicrosecond = static_cast<double>(frequency.QuadPart) / 1000000.0;
+	}
+
+private:
+	CRequestCostModel(const CRequestCostModel& model) = delete;
+
+	/// <summary>
+	/// Returns the entry of a tag, or `nullptr`, if the tag is not tracked. If `bInsert` is `TRUE`, an entry is claimed for untracked tags.
+	/// </summary>
+	CEstimate* FindEstimate(DWORD dwTag, BOOL bInsert) const throw()
+	{
+		// Zero marks free entries.
+		LONG64 llKey = static_cast<LONG64>(dwTag) + 1;
+		SIZE_T nIndex = static_cast<SIZE_T>(CHashPartitioning::MixHash(dwTag));
+
+		for (SIZE_T nProbe = 0; nProbe <= m_nMask; nProbe++)
+		{
+			CEstimate& estimate = m_estimates[(nIndex + nProbe) & m_nMask];
+			LONG64 llCurrent = estimate.m_llKey;
+
+			if (llCurrent == 0)
+			{
+				if (!bInsert)
+					return nullptr;
+
+				llCurrent = ::InterlockedCompareExchange64(&estimate.m_llKey, llKey, 0);
+
+				if (llCurrent == 0)
+					return &estimate;
+			}
+
+			if (llCurrent == llKey)
+				return &estimate;
+		}
+
+		return nullptr;
+	}
+
+public:
+	/// <summary>
+	/// Returns a timestamp, that can be passed to `Record` after a request has been executed.
+	/// </summary>
+	static LONGLONG GetTimestamp() throw()
+	{
+		LARGE_INTEGER counter;
+		::QueryPerformanceCounter(&counter);
+
+		return counter.QuadPart;
+	}
+
+	/// <summary>
+	/// Returns the number of microseconds, that have elapsed since the timestamp `llStart`.
+	/// </summary>
+	double GetElapsedMicroseconds(LONGLONG llStart) const throw()
+	{
+		return static_cast<double>(GetTimestamp() - llStart) / m_dTicksPerMicrosecond;
+	}
+
+	/// <summary>
+	/// Records the execution time of a request with the provided tag, that has been started at `llStart`.
+	/// </summary>
+	void Record(DWORD dwTag, LONGLONG llStart) throw()
+	{
+		this->RecordDuration(dwTag, this->GetElapsedMicroseconds(llStart));
+	}
+
+	/// <summary>
+	/// Records an execution time of `dDuration` microseconds for a request with the provided tag.
+	/// </summary>
+	void RecordDuration(DWORD dwTag, double dDuration) throw()
+	{
+		CEstimate* pEstimate = this->FindEstimate(dwTag, TRUE);
+
+		if (pEstimate == nullptr)
+			return;
+
+		::AcquireSRWLockExclusive(&pEstimate->m_lock);
+
+		if (pEstimate->m_ullSamples++ == 0)
+		{
+			pEstimate->m_dMean = dDuration;
+		}
+		else
+		{
+			// Incremental form of the exponentially weighted mean and variance.
+			double dDelta = dDuration - pEstimate->m_dMean;
+			double dIncrement = m_dSmoothing * dDelta;
+
+			pEstimate->m_dMean += dIncrement;
+			pEstimate->m_dVariance = (1.0 - m_dSmoothing) * (pEstimate->m_dVariance + dDelta * dIncrement);
+		}
+
+		::ReleaseSRWLockExclusive(&pEstimate->m_lock);
+	}
+
+	/// <summary>
+	/// Retrieves the estimated mean and variance of the execution time of requests with the provided tag in microseconds. Returns `FALSE`, if there are no
+	/// samples for the tag.
+	/// </summary>
+	BOOL GetEstimate(DWORD dwTag, double& dMean, double& dVariance) const throw()
+	{
+		CEstimate* pEstimate = this->FindEstimate(dwTag, FALSE);
+
+		if (pEstimate == nullptr)
+			return FALSE;
+
+		::AcquireSRWLockShared(&pEstimate->m_lock);
+
+		BOOL bResult = pEstimate->m_ullSamples != 0;
+		dMean = pEstimate->m_dMean;
+		dVariance = pEstimate->m_dVariance;
+
+		::ReleaseSRWLockShared(&pEstimate->m_lock);
+
+		return bResult;
+	}
+
+	/// <summary>
+	/// Returns the estimated execution time of requests with the provided tag in microseconds, or `dDefault`, if there are no samples for the tag.
+	/// </summary>
+	double GetExpectedCost(DWORD dwTag, double dDefault = 0.0) const throw()
+	{
+		double dMean, dVariance;
+
+		return this->GetEstimate(dwTag, dMean, dVariance) ? dMean : dDefault;
+	}
+};
+
+/// <summary>
+/// A thread pool, that dispatches requests derived from <see cref="CIntrusiveRequest">`CIntrusiveRequest`</see> approximately in the order of their expected
+/// execution time, as predicted by a <see cref="CRequestCostModel">`CRequestCostModel`</see> from their tag.
+/// </summary>
+/// <remarks>
+/// Dispatching short requests first reduces the mean latency of a mixed workload. To prevent starvation of long requests, a request is not ordered by its
+/// expected cost alone, but by a virtual deadline: the time it has been queued plus its expected cost, multiplied by `dCostWeight`. A request is therefore only
+/// overtaken by requests, that are queued until its expected cost (times the weight) has elapsed. Requests with unknown tags are expected to be short, so that
+/// their cost is learned quickly. The durations are measured around `Execute` and fed back into the model, which can also be queried by callers, i.e. to decide
+/// whether to execute a small piece of work inline or to split it up.
+/// </remarks>
+template <class TWorker, class TThreadTraits = ThreadProcHookThreadTraits<DefaultThreadTraits>, class TWaitTraits = DefaultWaitTraits, class TPolicy = CNullPoolPolicy>
+class CShortestJobFirstThreadPoolEx :
+	public CThreadPoolEx<TWorker, TThreadTraits, TWaitTraits, TPolicy>
+{
+	static_assert(std::is_base_of<CIntrusiveRequest, typename std::remove_pointer<typename TWorker::RequestType>::type>::value, "The request type must be derived from CIntrusiveRequest.");
+
+protected:
+	CRequestCostModel m_costModel;
+	CMultiQueue<typename TWorker::RequestType, double, std::greater<double>> m_requestQueue;
+	double m_dCostWeight;
+	LONGLONG m_llStart;
+
+public:
+	/// <summary>
+	/// Initializes the pool with `nQueuesPerProcessor` heaps for each logical processor and the provided weight of the expected cost of a request.
+	/// </summary>
+	explicit CShortestJobFirstThreadPoolEx(double dCostWeight = 16.0, UINT nQueuesPerProcessor = 2) :
+		m_requestQueue(nQueuesPerProcessor), m_dCostWeight(dCostWeight), m_llStart(CRequestCostModel::GetTimestamp())
+	{
+	}
+
+	virtual ~CShortestJobFirstThreadPoolEx() throw()
+	{
+		Shutdown();
+	}
+
+public:
+	/// <summary>
+	/// Returns the model, that predicts the execution time of requests by their tag.
+	/// </summary>
+	CRequestCostModel& GetCostModel() throw()
+	{
+		return m_costModel;
+	}
+
+	/// <summary>
+	/// Queues a request, that is dispatched according to the expected execution time of requests with the same tag.
+	/// </summary>
+	BOOL QueueRequest(typename TWorker::RequestType request)
+	{
+		// The virtual deadline is relative to the creation of the pool, in order to preserve the precision of the priority.
+		double dDeadline = m_costModel.GetElapsedMicroseconds(m_llStart) + m_dCostWeight * m_costModel.GetExpectedCost(request->GetTag());
+
+		m_requestQueue.Push(request, dDeadline);
+		this->WakeIdleWorker();
+
+		return TRUE;
+	}
+
+protected:
+	virtual BOOL DispatchQueuedRequest(TWorker& theWorker) throw() override
+	{
+		typename TWorker::RequestType request;
+
+		if (!m_requestQueue.Pop(request))
+			return FALSE;
+
+		// The worker may destroy the request, so its tag is read in advance.
+		DWORD dwTag = request->GetTag();
+		LONGLONG llStart = CRequestCostModel::GetTimestamp();
+
+		// Requests, that the policy has declined, i.e. cancelled ones, have not run, so their duration does not describe the cost of their tag.
+		if (this->ExecuteRequest(theWorker, request, nullptr))
+			m_costModel.Record(dwTag, llStart);
+
+		return TRUE;
+	}
+
+	virtual BOOL HasQueuedRequests() const throw() override
+	{
+		return !m_requestQueue.IsEmpty();
+	}
+};
+
+/// <summary>
+/// A batch of up to `nCapacity` homogeneous requests, whose fields are stored as a structure of arrays.
+/// </summary>
+/// <remarks>
+/// Each field type `TFields` is stored in its own cache-aligned column, so that a kernel, that processes all requests of a batch in a loop over the columns, can
+/// be vectorized by the compiler. Batches are queued by <see cref="CBatchThreadPoolEx">`CBatchThreadPoolEx`</see>.
+/// </remarks>
+template <SIZE_T nCapacity, class ... TFields>
+class CRequestBatch :
+	public CIntrusiveRequest
+{
+	static_assert(nCapacity > 0, "The batch capacity must not be zero.");
+	static_assert(sizeof...(TFields) > 0, "A batch requires at least one field.");
+
+public:
+	static const SIZE_T Capacity = nCapacity;
+
+private:
+	template <class TField>
+	struct DECLSPEC_CACHEALIGN CColumn
+	{
+		TField m_values[nCapacity];
+	};
+
+private:
+	std::tuple<CColumn<TFields> ...> m_columns;
+	SIZE_T m_nCount;
+
+public:
+	CRequestBatch() :
+		m_nCount(0)
+	{
+	}
+
+private:
+	CRequestBatch(const CRequestBatch& batch) = delete;
+
+	template <SIZE_T ... nFields>
+	void AddFields(std::index_sequence<nFields ...>, const TFields& ... fields)
+	{
+		int expand[] = { (std::get<nFields>(m_columns).m_values[m_nCount] = fields, 0) ... };
+		(void)expand;
+	}
+
+	template <class TKernel, SIZE_T ... nFields>
+	void ApplyKernel(TKernel& kernel, std::index_sequence<nFields ...>)
+	{
+		kernel(m_nCount, std::get<nFields>(m_columns).m_values ...);
+	}
+
+public:
+	/// <summary>
+	/// Returns the number of requests in the batch.
+	/// </summary>
+	SIZE_T GetCount() const throw()
+	{
+		return m_nCount;
+	}
+
+	/// <summary>
+	/// Returns `TRUE`, if no further requests can be added to the batch.
+	/// </summary>
+	BOOL IsFull() const throw()
+	{
+		return m_nCount == nCapacity;
+	}
+
+	/// <summary>
+	/// Returns the column, that stores the field with the index `nField` of all requests.
+	/// </summary>
+	template <SIZE_T nField>
+	typename std::tuple_element<nField, std::tuple<TFields ...>>::type* GetColumn() throw()
+	{
+		return std::get<nField>(m_columns).m_values;
+	}
+
+	/// <summary>
+	/// Appends a request, that consists of the provided fields. The batch must not be full.
+	/// </summary>
+	void Add(const TFields& ... fields)
+	{
+		this->AddFields(std::index_sequence_for<TFields ...>(), fields ...);
+		m_nCount++;
+	}
+
+	/// <summary>
+	/// Removes all requests from the batch and clears its cancellation, so that it can be reused.
+	/// </summary>
+	void Clear() throw()
+	{
+		m_nCount = 0;
+		this->ResetCancellation();
+	}
+
+	/// <summary>
+	/// Calls `kernel(nCount, pColumns...)` with the number of requests and a pointer to each column.
+	/// </summary>
+	template <class TKernel>
+	void Apply(TKernel&& kernel)
+	{
+		this->ApplyKernel(kernel, std::index_sequence_for<TFields ...>());
+	}
+};
+
+/// <summary>
+/// A thread pool, that collects homogeneous requests into <see cref="CRequestBatch">`CRequestBatch`</see> instances and passes whole batches to the worker.
+/// </summary>
+/// <remarks>
+/// `TWorker::RequestType` must be a pointer to a `CRequestBatch`. `QueueRequest` appends the fields of a request to the open batch, which is queued as soon as
+/// it is full. Idle workers also take the open batch, before it is full, so that requests are not delayed while the pool is underutilized, and batches only grow
+/// when all workers are busy. `Execute` acts as the batch kernel, i.e. by calling `Apply` on the batch. It must not delete the batch, which is owned by the pool
+/// and reused.
+/// </remarks>
+template <class TWorker, class TThreadTraits = ThreadProcHookThreadTraits<DefaultThreadTraits>, class TWaitTraits = DefaultWaitTraits, class TPolicy = CNullPoolPolicy>
+class CBatchThreadPoolEx :
+	public CThreadPoolEx<TWorker, TThreadTraits, TWaitTraits, TPolicy>
+{
+protected:
+	typedef typename std::remove_pointer<typename TWorker::RequestType>::type BatchType;
+
+	static_assert(std::is_base_of<CIntrusiveRequest, BatchType>::value, "The request type must be a pointer to a CRequestBatch.");
+
+protected:
+	SRWLOCK m_openBatchLock;
+	BatchType* volatile m_pOpenBatch;
+	CIntrusiveRequestQueue m_batchQueue;
+	CIntrusiveRequestQueue m_freeBatches;
+
+public:
+	CBatchThreadPoolEx() throw() :
+		m_pOpenBatch(nullptr)
+	{
+		::InitializeSRWLock(&m_openBatchLock);
+	}
+
+	virtual ~CBatchThreadPoolEx() throw()
+	{
+		Shutdown();
+
+		delete m_pOpenBatch;
+
+		for (CIntrusiveRequest* pBatch = m_batchQueue.Pop(); pBatch != nullptr; pBatch = m_batchQueue.Pop())
+			delete static_cast<BatchType*>(pBatch);
+
+		for (CIntrusiveRequest* pBatch = m_freeBatches.Pop(); pBatch != nullptr; pBatch = m_freeBatches.Pop())
+			delete static_cast<BatchType*>(pBatch);
+	}
+
+public:
+	/// <summary>
+	/// Queues a request, that consists of the provided fields.
+	/// </summary>
+	template <class ... TArgs>
+	BOOL QueueRequest(TArgs&& ... args)
+	{
+		BatchType* pFullBatch = nullptr;
+
+		::AcquireSRWLockExclusive(&m_openBatchLock);
+
+		while (m_pOpenBatch == nullptr)
+		{
+			// Do not allocate while holding the lock.
+			::ReleaseSRWLockExclusive(&m_openBatchLock);
+			BatchType* pBatch = static_cast<BatchType*>(m_freeBatches.Pop());
+
+			if (pBatch == nullptr)
+				pBatch = new BatchType();
+
+			::AcquireSRWLockExclusive(&m_openBatchLock);
+
+			if (m_pOpenBatch == nullptr)
+				m_pOpenBatch = pBatch;
+			else
+				m_freeBatches.Push(pBatch);
+		}
+
+		m_pOpenBatch->Add(std::forward<TArgs>(args) ...);
+
+		if (m_pOpenBatch->IsFull())
+		{
+			pFullBatch = m_pOpenBatch;
+			m_pOpenBatch = nullptr;
+		}
+
+		::ReleaseSRWLockExclusive(&m_openBatchLock);
+
+		if (pFullBatch != nullptr)
+			m_batchQueue.Push(pFullBatch);
+
+		this->WakeIdleWorker();
+
+		return TRUE;
+	}
+
+protected:
+	virtual BOOL DispatchQueuedRequest(TWorker& theWorker) throw() override
+	{
+		BatchType* pBatch = static_cast<BatchType*>(m_batchQueue.Pop());
+
+		if (pBatch == nullptr && m_pOpenBatch != nullptr)
+		{
+			// There are no full batches, so the worker would be idle otherwise.
+			::AcquireSRWLockExclusive(&m_openBatchLock);
+			pBatch = m_pOpenBatch;
+			m_pOpenBatch = nullptr;
+			::ReleaseSRWLockExclusive(&m_openBatchLock);
+		}
+
+		if (pBatch == nullptr)
+			return FALSE;
+
+		this->ExecuteRequest(theWorker, pBatch, nullptr);
+
+		pBatch->Clear();
+		m_freeBatches.Push(pBatch);
+
+		return TRUE;
+	}
+
+	virtual BOOL HasQueuedRequests() const throw() override
+	{
+		return !m_batchQueue.IsEmpty() || m_pOpenBatch != nullptr;
+	}
+};
+
+/// <summary>
+/// A thread pool with a number of workers, that is fixed at compile time.
+/// </summary>
+/// <remarks>
+/// Unlike `CThreadPool`, the pool cannot be resized, so it does not need a thread map, nor a lock to protect it. Worker handles and startup state are stored
+/// in arrays of `nThreads` elements, and the completion port is created with a concurrency of `nThreads`. Requests are posted to the completion port directly,
+/// without any further checks. The worker archetype is the same as for `CThreadPool`.
+/// </remarks>
+template <int nThreads, class TWorker, class TThreadTraits = DefaultThreadTraits>
+class CStaticThreadPool
+{
+	static_assert(nThreads > 0, "A static thread pool requires at least one worker.");
+
+public:
+	/// <summary>
+	/// The number of workers of the pool.
+	/// </summary>
+	static const int ThreadCount = nThreads;
+
+private:
+	struct CThreadContext
+	{
+		CStaticThreadPool* m_pPool;
+		BOOL m_bInitialized;
+	};
+
+private:
+	HANDLE m_hRequestQueue;
+	HANDLE m_hThreadEvent;
+	LPVOID m_pvWorkerParam;
+	int m_nStartedThreads;
+	std::array<HANDLE, nThreads> m_threads;
+	std::array<CThreadContext, nThreads> m_contexts;
+
+public:
+	CStaticThreadPool() throw() :
+		m_hRequestQueue(nullptr), m_hThreadEvent(nullptr), m_pvWorkerParam(nullptr), m_nStartedThreads(0)
+	{
+	}
+
+	~CStaticThreadPool() throw()
+	{
+		this->Shutdown();
+	}
+
+private:
+	CStaticThreadPool(const CStaticThreadPool& pool) = delete;
+
+public:
+	/// <summary>
+	/// Creates the completion port and starts all workers. Returns `E_FAIL`, if a worker could not be initialized.
+	/// </summary>
+	HRESULT Initialize(void* pvWorkerParam = nullptr, DWORD dwStackSize = 0, HANDLE hCompletion = INVALID_HANDLE_VALUE) throw()
+	{
+		ATLASSERT(m_hRequestQueue == nullptr);
+
+		m_pvWorkerParam = pvWorkerParam;
+		m_hRequestQueue = ::CreateIoCompletionPort(hCompletion, nullptr, 0, nThreads);
+
+		if (m_hRequestQueue == nullptr)
+			return AtlHresultFromLastError();
+
+		m_hThreadEvent = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+
+		if (m_hThreadEvent == nullptr)
+		{
+			HRESULT hr = AtlHresultFromLastError();
+			this->Shutdown();
+
+			return hr;
+		}
+
+		for (int nThread = 0; nThread < nThreads; nThread++)
+		{
+			CThreadContext& context = m_contexts[nThread];
+			context.m_pPool = this;
+			context.m_bInitialized = FALSE;
+
+			DWORD dwThreadId;
+			m_threads[nThread] = TThreadTraits::CreateThread(nullptr, dwStackSize, &CStaticThreadPool::WorkerThreadProc, &context, 0, &dwThreadId);
+
+			if (m_threads[nThread] == nullptr)
+			{
+				HRESULT hr = AtlHresultFromLastError();
+				this->Shutdown();
+
+				return hr;
+			}
+
+			m_nStartedThreads++;
+
+			// Wait for the worker to be initialized, before its context is evaluated.
+			::WaitForSingleObject(m_hThreadEvent, INFINITE);
+
+			if (!context.m_bInitialized)
+			{
+				this->Shutdown();
+
+				return E_FAIL;
+			}
+		}
+
+		return S_OK;
+	}
+
+	/// <summary>
+	/// Stops all workers, after they have finished the requests queued before.
+	/// </summary>
+	void Shutdown() throw()
+	{
+		for (int nThread = 0; nThread < m_nStartedThreads; nThread++)
+			::PostQueuedCompletionStatus(m_hRequestQueue, 0, 0, ATLS_POOL_SHUTDOWN);
+
+		for (int nThread = 0; nThread < m_nStartedThreads; nThread++)
+		{
+			::WaitForSingleObject(m_threads[nThread], INFINITE);
+			::CloseHandle(m_threads[nThread]);
+		}
+
+		m_nStartedThreads = 0;
+
+		if (m_hThreadEvent != nullptr)
+		{
+			::CloseHandle(m_hThreadEvent);
+			m_hThreadEvent = nullptr;
+		}
+
+		if (m_hRequestQueue != nullptr)
+		{
+			::CloseHandle(m_hRequestQueue);
+			m_hRequestQueue = nullptr;
+		}
+	}
+
+	/// <summary>
+	/// Queues a request for execution by a worker.
+	/// </summary>
+	BOOL QueueRequest(typename TWorker::RequestType request) throw()
+	{
+		return ::PostQueuedCompletionStatus(m_hRequestQueue, 0, (ULONG_PTR) request, nullptr);
+	}
+
+	/// <summary>
+	/// Returns the completion port, that is used to queue requests.
+	/// </summary>
+	HANDLE GetQueueHandle() const throw()
+	{
+		return m_hRequestQueue;
+	}
+
+	/// <summary>
+	/// Returns the number of workers of the pool.
+	/// </summary>
+	static constexpr int GetNumThreads() throw()
+	{
+		return nThreads;
+	}
+
+private:
+	static DWORD WINAPI WorkerThreadProc(LPVOID pv) throw()
+	{
+		CThreadContext* pContext = static_cast<CThreadContext*>(pv);
+
+		return pContext->m_pPool->ThreadProc(*pContext);
+	}
+
+	DWORD ThreadProc(CThreadContext& context) throw()
+	{
+		DWORD dwBytesTransfered;
+		ULONG_PTR dwCompletionKey;
+		OVERLAPPED* pOverlapped;
+
+		TWorker theWorker;
+
+		context.m_bInitialized = theWorker.Initialize(m_pvWorkerParam);
+		::SetEvent(m_hThreadEvent);
+
+		if (!context.m_bInitialized)
+			return 1;
+
+		while (TRUE)
+		{
+			BOOL bStatus = ::GetQueuedCompletionStatus(m_hRequestQueue, &dwBytesTransfered, &dwCompletionKey, &pOverlapped, INFINITE);
+
+			if (pOverlapped == ATLS_POOL_SHUTDOWN)
+				break;
+			else if (bStatus)
+				theWorker.Execute((typename TWorker::RequestType) dwCompletionKey, m_pvWorkerParam, pOverlapped);
+			else if (pOverlapped == nullptr)
+				break;
+		}
+
+		theWorker.Terminate(m_pvWorkerParam);
+
+		return 0;
+	}
+};